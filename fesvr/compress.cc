@@ -7,9 +7,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <thread>
@@ -226,3 +228,220 @@ ssize_t compressors_t::select_compressor() {
   }
   return -1;
 }
+
+static constexpr size_t kMinMatch = 4, kMaxOffset = 65535, kHashBits = 14;
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t x) {
+  while (x >= 0x80) {
+    out.push_back(static_cast<uint8_t>(x) | 0x80);
+    x >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(x));
+}
+
+static bool get_varint(const uint8_t *&p, const uint8_t *end, uint64_t &x) {
+  x = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p == end) return false;
+    uint8_t b = *p++;
+    x |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+static uint32_t read32(const uint8_t *p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+void lz_compress(const uint8_t *in, size_t len, std::vector<uint8_t> &out) {
+  std::vector<int64_t> table(size_t(1) << kHashBits, -1);
+  size_t lit_start = 0, i = 0;
+
+  while (i + kMinMatch <= len) {
+    uint32_t word = read32(in + i);
+    size_t h = (word * 2654435761u) >> (32 - kHashBits);
+    int64_t cand = table[h];
+    table[h] = i;
+
+    if (cand < 0 || i - cand > kMaxOffset || read32(in + cand) != word) {
+      i++;
+      continue;
+    }
+
+    size_t match = kMinMatch;
+    while (i + match < len && in[cand + match] == in[i + match]) match++;
+
+    put_varint(out, i - lit_start);
+    out.insert(out.end(), in + lit_start, in + i);
+    put_varint(out, match - kMinMatch);
+    put_varint(out, i - cand);
+
+    i += match;
+    lit_start = i;
+  }
+
+  put_varint(out, len - lit_start);
+  out.insert(out.end(), in + lit_start, in + len);
+}
+
+bool lz_decompress(const uint8_t *in, size_t len, size_t raw_len,
+                   std::vector<uint8_t> &out) {
+  // a corrupt block must not grow the output past raw_len, nor refer to
+  // bytes before the start of its own output
+  const uint8_t *p = in, *end = in + len;
+  size_t start = out.size(), limit = start + raw_len;
+  while (true) {
+    uint64_t lits, match, offset;
+    if (!get_varint(p, end, lits) || lits > static_cast<size_t>(end - p) ||
+        lits > limit - out.size())
+      return false;
+    out.insert(out.end(), p, p + lits);
+    p += lits;
+    if (p == end) return out.size() == limit;
+
+    if (!get_varint(p, end, match) || !get_varint(p, end, offset) ||
+        offset == 0 || offset > out.size() - start ||
+        match > limit - out.size() || match + kMinMatch > limit - out.size())
+      return false;
+    // the match may overlap the bytes it produces, so copy one at a time
+    size_t from = out.size() - offset;
+    for (size_t k = 0; k < match + kMinMatch; k++) out.push_back(out[from + k]);
+  }
+}
+
+static void put_u32(uint8_t *p, uint32_t x) {
+  for (int i = 0; i < 4; i++) p[i] = static_cast<uint8_t>(x >> (8 * i));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+  uint32_t x = 0;
+  for (int i = 0; i < 4; i++) x |= static_cast<uint32_t>(p[i]) << (8 * i);
+  return x;
+}
+
+block_compressor_t::block_compressor_t(FILE *out, size_t block_size)
+    : out_(out), block_size_(block_size), done_(false) {
+  fwrite(kBlockStreamMagic, 1, strlen(kBlockStreamMagic), out_);
+  block_.reserve(block_size_);
+  thread_ = std::thread(&block_compressor_t::run, this);
+}
+
+block_compressor_t::~block_compressor_t() {
+  flush();
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    done_ = true;
+  }
+  work_.notify_one();
+  thread_.join();
+  fflush(out_);
+}
+
+void block_compressor_t::write(const void *data, size_t len) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  while (len > 0) {
+    size_t n = std::min(len, block_size_ - block_.size());
+    block_.insert(block_.end(), p, p + n);
+    p += n;
+    len -= n;
+    if (block_.size() == block_size_) flush();
+  }
+}
+
+void block_compressor_t::flush() {
+  if (block_.empty()) return;
+
+  std::unique_lock<std::mutex> guard(lock_);
+  space_.wait(guard, [this] { return queue_.size() < kMaxQueuedBlocks; });
+  queue_.push_back(std::move(block_));
+  guard.unlock();
+  work_.notify_one();
+
+  block_ = std::vector<uint8_t>();
+  block_.reserve(block_size_);
+}
+
+void block_compressor_t::run() {
+  std::vector<uint8_t> stored;
+  std::unique_lock<std::mutex> guard(lock_);
+  while (true) {
+    work_.wait(guard, [this] { return done_ || !queue_.empty(); });
+    if (queue_.empty()) break;
+    std::vector<uint8_t> raw = std::move(queue_.front());
+    queue_.pop_front();
+    guard.unlock();
+    space_.notify_one();
+
+    stored.assign(8, 0);
+    lz_compress(raw.data(), raw.size(), stored);
+    if (stored.size() - 8 >= raw.size()) {
+      stored.resize(8);
+      stored.insert(stored.end(), raw.begin(), raw.end());
+    }
+    put_u32(&stored[0], raw.size());
+    put_u32(&stored[4], stored.size() - 8);
+    fwrite(stored.data(), 1, stored.size(), out_);
+
+    guard.lock();
+  }
+}
+
+struct block_cookie_t {
+  FILE *out;
+  block_compressor_t *compressor;
+};
+
+static ssize_t block_cookie_write(void *cookie, const char *buf, size_t size) {
+  static_cast<block_cookie_t *>(cookie)->compressor->write(buf, size);
+  return size;
+}
+
+static int block_cookie_close(void *cookie) {
+  auto c = static_cast<block_cookie_t *>(cookie);
+  delete c->compressor;
+  int ret = fclose(c->out);
+  delete c;
+  return ret;
+}
+
+FILE *block_compressor_t::open(FILE *out) {
+  cookie_io_functions_t funcs = {};
+  funcs.write = block_cookie_write;
+  funcs.close = block_cookie_close;
+  auto cookie = new block_cookie_t{out, new block_compressor_t(out)};
+  FILE *f = fopencookie(cookie, "w", funcs);
+  if (!f) {
+    delete cookie->compressor;
+    delete cookie;
+  }
+  return f;
+}
+
+bool block_decompressor_t::open() {
+  char magic[sizeof(kBlockStreamMagic) - 1];
+  return fread(magic, 1, sizeof(magic), in_) == sizeof(magic) &&
+         memcmp(magic, kBlockStreamMagic, sizeof(magic)) == 0;
+}
+
+bool block_decompressor_t::next(std::vector<uint8_t> &out) {
+  uint8_t header[8];
+  size_t got = fread(header, 1, sizeof(header), in_);
+  if (got == 0) return false;
+  if (got != sizeof(header)) return !(error_ = true);
+
+  uint32_t raw_len = get_u32(header), stored_len = get_u32(header + 4);
+  stored_.resize(stored_len);
+  if (fread(stored_.data(), 1, stored_len, in_) != stored_len)
+    return !(error_ = true);
+
+  out.clear();
+  if (stored_len == raw_len) {
+    out = stored_;
+  } else if (!lz_decompress(stored_.data(), stored_len, raw_len, out)) {
+    return !(error_ = true);
+  }
+  return true;
+}
@@ -5,7 +5,13 @@
 
 #include <sys/types.h>
 
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 class compressor_t {
@@ -58,4 +64,68 @@ class compressors_t {
   std::vector<compressor_t> compressors_;
 };
 
+// In-memory LZ77 codec for the block stream below.  A block is a sequence of
+// (literal run, match) pairs: varint literal count, the literals, then, unless
+// the block ends there, varint (match length - kMinMatch) and varint offset.
+// lz_decompress fails unless the block decodes to exactly raw_len bytes.
+void lz_compress(const uint8_t *in, size_t len, std::vector<uint8_t> &out);
+bool lz_decompress(const uint8_t *in, size_t len, size_t raw_len,
+                   std::vector<uint8_t> &out);
+
+// Block-framed compressed stream:
+//   stream: kBlockStreamMagic block*
+//   block:  raw length (u32 le), stored length (u32 le), stored bytes
+// The stored bytes are the block compressed with lz_compress, or the raw
+// bytes if compression did not make them smaller (stored == raw length).
+// Each block decompresses on its own.
+static constexpr char kBlockStreamMagic[] = "SPKZ";
+
+// Compresses everything written to it on a worker thread and appends the
+// blocks to a file.  The writing thread only copies into a buffer.
+class block_compressor_t {
+ public:
+  block_compressor_t(FILE *out, size_t block_size = 1 << 20);
+  // compresses and writes out everything written so far
+  ~block_compressor_t();
+
+  void write(const void *data, size_t len);
+  void flush();
+
+  // Returns a stdio stream whose output goes through a new compressor into
+  // out.  Closing the stream finishes the compressed stream and closes out.
+  static FILE *open(FILE *out);
+
+ private:
+  static constexpr size_t kMaxQueuedBlocks = 16;
+
+  void run();
+
+  FILE *out_;
+  size_t block_size_;
+  std::vector<uint8_t> block_;
+  std::mutex lock_;
+  std::condition_variable work_, space_;
+  std::deque<std::vector<uint8_t>> queue_;
+  bool done_;
+  std::thread thread_;
+};
+
+// Reads a stream written by block_compressor_t, one block at a time.
+class block_decompressor_t {
+ public:
+  block_decompressor_t(FILE *in) : in_(in) {}
+
+  // checks the stream magic
+  bool open();
+  // decompresses the next block into out; false at the end of the stream
+  // or on a malformed block (see error())
+  bool next(std::vector<uint8_t> &out);
+  bool error() const { return error_; }
+
+ private:
+  FILE *in_;
+  bool error_ = false;
+  std::vector<uint8_t> stored_;
+};
+
 #endif
@@ -56,6 +56,7 @@ void device_t::handle_identify(command_t cmd)
 }
 
 bcd_t::bcd_t()
+  : ticks(0)
 {
   register_command(0, std::bind(&bcd_t::handle_read, this, _1), "read");
   register_command(1, std::bind(&bcd_t::handle_write, this, _1), "write");
@@ -63,6 +64,8 @@ bcd_t::bcd_t()
 
 void bcd_t::handle_read(command_t cmd)
 {
+  // show any prompt before the target starts waiting for input
+  canonical_terminal_t::flush();
   pending_reads.push(cmd);
 }
 
@@ -73,6 +76,13 @@ void bcd_t::handle_write(command_t cmd)
 
 void bcd_t::tick()
 {
+  // partial lines are flushed and the terminal polled only every so many
+  // ticks, which keeps an idle console out of the host's way
+  if (++ticks < POLL_INTERVAL)
+    return;
+  ticks = 0;
+  canonical_terminal_t::flush();
+
   int ch;
   if (!pending_reads.empty() && (ch = canonical_terminal_t::read()) != -1)
   {
@@ -68,6 +68,8 @@ class bcd_t : public device_t
   void handle_read(command_t cmd);
   void handle_write(command_t cmd);
 
+  static const unsigned POLL_INTERVAL = 64;
+  unsigned ticks;
   std::queue<command_t> pending_reads;
 };
 
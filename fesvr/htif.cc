@@ -124,6 +124,12 @@ std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload,
         memif_t::write(taddr, len, src);
     }
 
+    void clear(addr_t taddr, size_t len) override
+    {
+      if (!htif->is_address_preloaded(taddr, len))
+        memif_t::clear(taddr, len);
+    }
+
    private:
     htif_t* htif;
   } preload_aware_memif(this);
@@ -180,8 +186,20 @@ const char* htif_t::get_symbol(uint64_t addr)
   return it->second.c_str();
 }
 
+const char* htif_t::get_nearest_symbol(uint64_t addr)
+{
+  auto it = addr2symbol.upper_bound(addr);
+
+  if (it == addr2symbol.begin())
+    return nullptr;
+
+  return std::prev(it)->second.c_str();
+}
+
 void htif_t::stop()
 {
+  syscall_proxy.stop_async_io();
+
   if (!sig_file.empty() && sig_len) // print final torture test signature
   {
     std::vector<uint8_t> buf(sig_len);
@@ -232,10 +250,10 @@ int htif_t::run()
 
   while (!signal_exit && exitcode == 0)
   {
-    uint64_t tohost;
+    uint64_t tohost = 0;
 
     try {
-      if ((tohost = from_target(mem.read_uint64(tohost_addr))) != 0)
+      if (tohost_written() && (tohost = from_target(mem.read_uint64(tohost_addr))) != 0)
         mem.write_uint64(tohost_addr, target_endian<uint64_t>::zero);
     } catch (mem_trap_t& t) {
       bad_address("accessing tohost", t.get_tval());
@@ -300,7 +318,7 @@ void htif_t::parse_arguments(int argc, char ** argv)
         break;
       case HTIF_LONG_OPTIONS_OPTIND + 1:
         // [TODO] Remove once disks are supported again
-        throw std::invalid_argument("--disk/+disk unsupported (use a ramdisk)");
+        throw std::invalid_argument("--disk/+disk unsupported (use a ramdisk, or spike's --virtio-blk)");
         dynamic_devices.push_back(new disk_t(optarg));
         break;
       case HTIF_LONG_OPTIONS_OPTIND + 2:
@@ -315,6 +333,9 @@ void htif_t::parse_arguments(int argc, char ** argv)
       case HTIF_LONG_OPTIONS_OPTIND + 5:
         line_size = atoi(optarg);
 
+        break;
+      case HTIF_LONG_OPTIONS_OPTIND + 6:
+        syscall_proxy.set_async_io(atoi(optarg));
         break;
       case '?':
         if (!opterr)
@@ -354,6 +375,10 @@ void htif_t::parse_arguments(int argc, char ** argv)
             c = HTIF_LONG_OPTIONS_OPTIND + 5;
             optarg = optarg + 23;
         }
+        else if (arg.find("+async-io=") == 0) {
+          c = HTIF_LONG_OPTIONS_OPTIND + 6;
+          optarg = optarg + 10;
+        }
         else if (arg.find("+permissive-off") == 0) {
           if (opterr)
             throw std::invalid_argument("Found +permissive-off when not parsing permissively");
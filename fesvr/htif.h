@@ -48,6 +48,12 @@ class htif_t : public chunked_memif_t, public syscall_host_t
   const std::vector<std::string>& host_args() { return hargs; }
 
   reg_t get_entry_point() { return entry; }
+  addr_t get_tohost_addr() { return tohost_addr; }
+
+  // Returns false if the target cannot have written tohost since the last
+  // call, so run() need not read it.  Subclasses that can watch target
+  // stores override this to keep run() from polling tohost every time.
+  virtual bool tohost_written() { return true; }
 
   // indicates that the initial program load can skip writing this address
   // range to memory, because it has already been loaded through a sideband
@@ -55,6 +61,9 @@ class htif_t : public chunked_memif_t, public syscall_host_t
 
   // Given an address, return symbol from addr2symbol map
   const char* get_symbol(uint64_t addr);
+  // Given an address, return the symbol at or below it, so that addresses
+  // inside a function map to the function
+  const char* get_nearest_symbol(uint64_t addr);
 
  private:
   void parse_arguments(int argc, char ** argv);
@@ -109,10 +118,12 @@ class htif_t : public chunked_memif_t, public syscall_host_t
        +chroot=PATH\n\
       --payload=PATH       Load PATH memory as an additional ELF payload\n\
        +payload=PATH\n\
+      --async-io=N         Run blocking file syscalls on N host threads, so\n\
+       +async-io=N           other harts keep running while one waits on I/O\n\
 \n\
 HOST OPTIONS (currently unsupported)\n\
-      --disk=DISK          Add DISK device. Use a ramdisk since this isn't\n\
-       +disk=DISK            supported\n\
+      --disk=DISK          Add DISK device. Not supported; spike provides\n\
+       +disk=DISK            --virtio-blk=DISK instead\n\
 \n\
 TARGET (RISC-V BINARY) OPTIONS\n\
   These are the options passed to the program executing on the emulated RISC-V\n\
@@ -127,6 +138,7 @@ TARGET (RISC-V BINARY) OPTIONS\n\
 {"chroot",    required_argument, 0, HTIF_LONG_OPTIONS_OPTIND + 3 },     \
 {"payload",   required_argument, 0, HTIF_LONG_OPTIONS_OPTIND + 4 },     \
 {"signature-granularity",    optional_argument, 0, HTIF_LONG_OPTIONS_OPTIND + 5 },     \
+{"async-io",  required_argument, 0, HTIF_LONG_OPTIONS_OPTIND + 6 },     \
 {0, 0, 0, 0}
 
 #endif // __HTIF_H
@@ -0,0 +1,100 @@
+// See LICENSE for license details.
+
+#include "io_workers.h"
+#include <stdexcept>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+io_workers_t::io_workers_t(unsigned nthreads)
+  : running(0), nfinished(0), stopping(false), stop_fd(eventfd(0, EFD_CLOEXEC))
+{
+  if (stop_fd < 0)
+    throw std::runtime_error("could not create the I/O workers' eventfd");
+  for (unsigned i = 0; i < nthreads; i++)
+    threads.emplace_back(&io_workers_t::run, this);
+}
+
+io_workers_t::~io_workers_t()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    queued.clear();
+  }
+  work_ready.notify_all();
+  uint64_t one = 1;
+  while (write(stop_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+  for (auto& t : threads)
+    t.join();
+  close(stop_fd);
+}
+
+void io_workers_t::submit(job_t work, job_t done)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    queued.emplace_back(std::move(work), std::move(done));
+  }
+  work_ready.notify_one();
+}
+
+void io_workers_t::poll()
+{
+  if (nfinished.load(std::memory_order_acquire) == 0)
+    return;
+
+  std::vector<job_t> done;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    done.swap(finished);
+    nfinished.store(0, std::memory_order_relaxed);
+  }
+  for (auto& f : done)
+    f();
+}
+
+void io_workers_t::drain()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  idle.wait(guard, [&]{ return queued.empty() && running == 0; });
+}
+
+bool io_workers_t::wait_ready(int fd, short events)
+{
+  // poll() would skip a bad fd and wait for the stop alone
+  if (fd < 0)
+    return true;
+
+  struct pollfd fds[2] = {{fd, events, 0}, {stop_fd, POLLIN, 0}};
+  while (::poll(fds, 2, -1) < 0)
+    if (errno != EINTR)
+      return true; // let the I/O call itself report the problem
+  return !(fds[1].revents & POLLIN);
+}
+
+void io_workers_t::run()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    work_ready.wait(guard, [&]{ return stopping || !queued.empty(); });
+    if (stopping)
+      break;
+
+    auto job = std::move(queued.front());
+    queued.pop_front();
+    running++;
+    guard.unlock();
+
+    job.first();
+
+    guard.lock();
+    running--;
+    finished.push_back(std::move(job.second));
+    nfinished.store(finished.size(), std::memory_order_release);
+    if (queued.empty() && running == 0)
+      idle.notify_all();
+  }
+}
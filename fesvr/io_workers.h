@@ -0,0 +1,54 @@
+// See LICENSE for license details.
+
+#ifndef __IO_WORKERS_H
+#define __IO_WORKERS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of host threads for blocking I/O.  Each job has a part that
+// runs on a worker and a part that runs back on the thread that calls
+// poll(), after the first part has returned.  The worker parts should
+// block only in wait_ready(), so that they can be stopped.
+class io_workers_t
+{
+ public:
+  typedef std::function<void()> job_t;
+
+  io_workers_t(unsigned nthreads);
+  // stops the jobs already handed to a worker and waits for them; their
+  // done parts and jobs still queued are dropped
+  ~io_workers_t();
+
+  void submit(job_t work, job_t done);
+  // runs the done part of every job that has finished
+  void poll();
+  // waits until the worker part of every job submitted so far has
+  // returned, leaving their done parts to poll()
+  void drain();
+  // called from a worker part: blocks until fd is ready for the poll(2)
+  // events, or returns false once the workers are being stopped
+  bool wait_ready(int fd, short events);
+
+ private:
+  void run();
+
+  std::mutex lock;
+  std::condition_variable work_ready;
+  std::condition_variable idle;
+  std::deque<std::pair<job_t, job_t>> queued;
+  size_t running;
+  std::vector<job_t> finished;
+  std::atomic<size_t> nfinished;
+  bool stopping;
+  // an eventfd that becomes readable when stopping is set
+  int stop_fd;
+  std::vector<std::thread> threads;
+};
+
+#endif
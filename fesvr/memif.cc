@@ -4,9 +4,80 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdexcept>
+#include <vector>
 #include "memif.h"
 
 void memif_t::read(addr_t addr, size_t len, void* bytes)
+{
+  while (len > 0) {
+    size_t this_len = std::min(len, DIRECT_PAGE_SIZE - size_t(addr % DIRECT_PAGE_SIZE));
+    if (char* host = cmemif->direct_host_addr(addr, this_len))
+      memcpy(bytes, host, this_len);
+    else
+      read_chunked(addr, this_len, bytes);
+
+    bytes = (char*)bytes + this_len;
+    addr += this_len;
+    len -= this_len;
+  }
+}
+
+void memif_t::write(addr_t addr, size_t len, const void* bytes)
+{
+  while (len > 0) {
+    size_t this_len = std::min(len, DIRECT_PAGE_SIZE - size_t(addr % DIRECT_PAGE_SIZE));
+    if (char* host = cmemif->direct_host_addr(addr, this_len))
+      memcpy(host, bytes, this_len);
+    else
+      write_chunked(addr, this_len, bytes);
+
+    bytes = (const char*)bytes + this_len;
+    addr += this_len;
+    len -= this_len;
+  }
+}
+
+bool memif_t::map_file(addr_t addr, size_t len, int fd, off_t offset)
+{
+  if (addr % DIRECT_PAGE_SIZE || len % DIRECT_PAGE_SIZE || offset % DIRECT_PAGE_SIZE)
+    return false;
+  return cmemif->map_file(addr, len, fd, offset);
+}
+
+void memif_t::clear(addr_t addr, size_t len)
+{
+  size_t align = cmemif->chunk_align();
+  size_t head = std::min(len, size_t(-addr % align));
+  size_t body = (len - head) & ~(align - 1);
+  std::vector<uint8_t> zeros(align);
+
+  write(addr, head, zeros.data());
+  if (body)
+    cmemif->clear_chunk(addr + head, body);
+  write(addr + head + body, len - head - body, zeros.data());
+}
+
+bool memif_t::host_spans(addr_t addr, size_t len, std::vector<struct iovec>& spans)
+{
+  spans.clear();
+  while (len > 0) {
+    size_t this_len = std::min(len, DIRECT_PAGE_SIZE - size_t(addr % DIRECT_PAGE_SIZE));
+    char* host = cmemif->direct_host_addr(addr, this_len);
+    if (!host)
+      return false;
+
+    if (!spans.empty() && (char*)spans.back().iov_base + spans.back().iov_len == host)
+      spans.back().iov_len += this_len;
+    else
+      spans.push_back({host, this_len});
+
+    addr += this_len;
+    len -= this_len;
+  }
+  return true;
+}
+
+void memif_t::read_chunked(addr_t addr, size_t len, void* bytes)
 {
   size_t align = cmemif->chunk_align();
   if (len && (addr & (align-1)))
@@ -39,7 +110,7 @@ void memif_t::read(addr_t addr, size_t len, void* bytes)
     cmemif->read_chunk(addr + pos, std::min(cmemif->chunk_max_size(), len - pos), (char*)bytes + pos);
 }
 
-void memif_t::write(addr_t addr, size_t len, const void* bytes)
+void memif_t::write_chunked(addr_t addr, size_t len, const void* bytes)
 {
   size_t align = cmemif->chunk_align();
   if (len && (addr & (align-1)))
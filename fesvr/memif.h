@@ -5,6 +5,9 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
 #include "byteorder.h"
 
 typedef uint64_t reg_t;
@@ -29,6 +32,22 @@ public:
   virtual size_t chunk_align() = 0;
   virtual size_t chunk_max_size() = 0;
 
+  // Host memory holding the target bytes [taddr, taddr + len), which lie
+  // within one memif_t::DIRECT_PAGE_SIZE page, or NULL if they must be
+  // accessed through the chunk functions (e.g. because they are MMIO).
+  // memif_t copies directly to and from the memory returned.
+  virtual char* direct_host_addr(addr_t taddr, size_t len) { return NULL; }
+
+  // Makes the target range [taddr, taddr + len) a private copy-on-write
+  // mapping of the file fd at offset, all multiples of
+  // memif_t::DIRECT_PAGE_SIZE, or returns false if that is not supported.
+  virtual bool map_file(addr_t taddr, size_t len, int fd, off_t offset) { return false; }
+  // Whether map_file has mapped the file dev:ino into target memory, and
+  // copies whatever it mapped, so that the file may change underneath;
+  // detach_file returns false if it could not.
+  virtual bool maps_file(dev_t dev, ino_t ino) { return false; }
+  virtual bool detach_file(dev_t dev, ino_t ino) { return true; }
+
   virtual void set_target_endianness(memif_endianness_t endianness) {}
   virtual memif_endianness_t get_target_endianness() const {
     return memif_endianness_undecided;
@@ -45,6 +64,28 @@ public:
   virtual void read(addr_t addr, size_t len, void* bytes);
   virtual void write(addr_t addr, size_t len, const void* bytes);
 
+  // read and write are split at multiples of this before asking
+  // chunked_memif_t::direct_host_addr for host memory
+  static const size_t DIRECT_PAGE_SIZE = 4096;
+
+  // map [addr, addr + len) from the file fd at offset, all multiples of
+  // DIRECT_PAGE_SIZE (see chunked_memif_t::map_file); returns false,
+  // leaving the target memory alone, if that is not possible
+  bool map_file(addr_t addr, size_t len, int fd, off_t offset);
+  // detach_file must be called before the file dev:ino is written to or
+  // truncated, if maps_file says it is mapped (see chunked_memif_t)
+  bool maps_file(dev_t dev, ino_t ino) { return cmemif->maps_file(dev, ino); }
+  bool detach_file(dev_t dev, ino_t ino) { return cmemif->detach_file(dev, ino); }
+  // zero a byte array; the aligned part goes through clear_chunk, which
+  // need not touch memory that was never written
+  virtual void clear(addr_t addr, size_t len);
+
+  // Fills spans with the host memory holding the target bytes
+  // [addr, addr + len), merging pages that are contiguous on the host, and
+  // returns true; returns false if any of the bytes have no host memory
+  // (see chunked_memif_t::direct_host_addr).
+  bool host_spans(addr_t addr, size_t len, std::vector<struct iovec>& spans);
+
   // read and write 8-bit words
   virtual target_endian<uint8_t> read_uint8(addr_t addr);
   virtual target_endian<int8_t> read_int8(addr_t addr);
@@ -79,6 +120,10 @@ public:
 
 protected:
   chunked_memif_t* cmemif;
+
+private:
+  void read_chunked(addr_t addr, size_t len, void* bytes);
+  void write_chunked(addr_t addr, size_t len, const void* bytes);
 };
 
 #endif // __MEMIF_H
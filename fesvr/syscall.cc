@@ -2,6 +2,8 @@
 
 #include "syscall.h"
 #include "byteorder.h"
+#include "syscall_ring.h"
+#include "term.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -11,6 +13,8 @@
 #include <assert.h>
 #include <termios.h>
 #include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <sstream>
 #include <iostream>
 using namespace std::placeholders;
@@ -138,7 +142,8 @@ struct riscv_statx
 #endif
 
 syscall_t::syscall_t(syscall_host_t* host)
-  : host(host), memif(&host->memif()), table(2048), compressors(64, 1024, 0.9)
+  : host(host), memif(&host->memif()), table(2048), compressors(64, 1024, 0.9),
+    ring_addr(0), ring_entries(0), ring_draining(false)
 {
   table[17] = &syscall_t::sys_getcwd;
   table[25] = &syscall_t::sys_fcntl;
@@ -166,6 +171,9 @@ syscall_t::syscall_t(syscall_host_t* host)
   table[2012] = &syscall_t::sys_getfdpath;
   table[2013] = &syscall_t::sys_compressfile;
   table[2014] = &syscall_t::sys_compressquery;
+  table[2017] = &syscall_t::sys_mapfile;
+  table[SYS_ring_setup] = &syscall_t::sys_ring_setup;
+  table[SYS_ring_enter] = &syscall_t::sys_ring_enter;
 
   register_command(0, std::bind(&syscall_t::handle_syscall, this, _1), "syscall");
 
@@ -197,6 +205,10 @@ std::string syscall_t::undo_chroot(const char* fn)
 
 void syscall_t::handle_syscall(command_t cmd)
 {
+  // keep console output ordered with what the target writes to stdout, and
+  // make sure none of it is left behind when the target exits
+  canonical_terminal_t::flush();
+
   if (cmd.payload() & 1) // test pass/fail
   {
     host->set_exit_code(cmd.payload());
@@ -204,6 +216,9 @@ void syscall_t::handle_syscall(command_t cmd)
       std::cerr << "*** FAILED *** (tohost = " << host->exit_code() << ")" << std::endl;
     return;
   }
+
+  if (workers && dispatch_async(cmd))
+    return;
   else // proxied system call
     dispatch(cmd.payload());
 
@@ -221,40 +236,92 @@ static reg_t sysret_errno(sreg_t ret)
   return ret == -1 ? -errno : ret;
 }
 
+// Resolves the target buffer to its host spans, or sets up a bounce buffer
+// (filled from the target for a write) if it has no host memory.
+void syscall_t::io_prepare(io_transfer_t& t, reg_t fd, reg_t pbuf, reg_t len, bool write, bool positional, reg_t off)
+{
+  t.fd = fds.lookup(fd);
+  t.pbuf = pbuf;
+  t.write = write;
+  t.positional = positional;
+  t.off = off;
+
+  t.bounced = !host->host_spans(pbuf, len, t.iov);
+  if (t.bounced) {
+    t.bounce.resize(len);
+    t.iov.assign(1, {t.bounce.data(), len});
+    if (write)
+      memif->read(pbuf, len, t.bounce.data());
+  }
+}
+
+// Transfers at most IOV_MAX spans per call, stopping at the first short one.
+void io_transfer_t::run(io_workers_t* workers)
+{
+  ssize_t total = 0;
+  for (size_t i = 0; i < iov.size(); i += IOV_MAX) {
+    int n = std::min<size_t>(IOV_MAX, iov.size() - i);
+    size_t want = 0;
+    for (int j = 0; j < n; j++)
+      want += iov[i + j].iov_len;
+
+    if (workers && !workers->wait_ready(fd, write ? POLLOUT : POLLIN)) {
+      ret = total ? total : -EINTR;
+      return;
+    }
+
+    ssize_t res;
+    if (positional)
+      res = write ? pwritev(fd, &iov[i], n, off + total) : preadv(fd, &iov[i], n, off + total);
+    else
+      res = write ? writev(fd, &iov[i], n) : readv(fd, &iov[i], n);
+
+    if (res < 0) {
+      if (total == 0) {
+        ret = -errno;
+        return;
+      }
+      break;
+    }
+    total += res;
+    if (size_t(res) < want)
+      break;
+  }
+  ret = total;
+}
+
+reg_t syscall_t::io_finish(io_transfer_t& t)
+{
+  if (t.bounced && !t.write && t.ret > 0)
+    memif->write(t.pbuf, t.ret, t.bounce.data());
+  return t.ret;
+}
+
+reg_t syscall_t::do_io(reg_t fd, reg_t pbuf, reg_t len, bool write, bool positional, reg_t off)
+{
+  io_prepare(io, fd, pbuf, len, write, positional, off);
+  io.run();
+  return io_finish(io);
+}
+
 reg_t syscall_t::sys_read(reg_t fd, reg_t pbuf, reg_t len, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
 {
-  std::vector<char> buf(len);
-  ssize_t ret = read(fds.lookup(fd), buf.data(), len);
-  reg_t ret_errno = sysret_errno(ret);
-  if (ret > 0)
-    memif->write(pbuf, ret, buf.data());
-  return ret_errno;
+  return do_io(fd, pbuf, len, false, false, 0);
 }
 
 reg_t syscall_t::sys_pread(reg_t fd, reg_t pbuf, reg_t len, reg_t off, reg_t a4, reg_t a5, reg_t a6)
 {
-  std::vector<char> buf(len);
-  ssize_t ret = pread(fds.lookup(fd), buf.data(), len, off);
-  reg_t ret_errno = sysret_errno(ret);
-  if (ret > 0)
-    memif->write(pbuf, ret, buf.data());
-  return ret_errno;
+  return do_io(fd, pbuf, len, false, true, off);
 }
 
 reg_t syscall_t::sys_write(reg_t fd, reg_t pbuf, reg_t len, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
 {
-  std::vector<char> buf(len);
-  memif->read(pbuf, len, buf.data());
-  reg_t ret = sysret_errno(write(fds.lookup(fd), buf.data(), len));
-  return ret;
+  return do_io(fd, pbuf, len, true, false, 0);
 }
 
 reg_t syscall_t::sys_pwrite(reg_t fd, reg_t pbuf, reg_t len, reg_t off, reg_t a4, reg_t a5, reg_t a6)
 {
-  std::vector<char> buf(len);
-  memif->read(pbuf, len, buf.data());
-  reg_t ret = sysret_errno(pwrite(fds.lookup(fd), buf.data(), len, off));
-  return ret;
+  return do_io(fd, pbuf, len, true, true, off);
 }
 
 reg_t syscall_t::sys_close(reg_t fd, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
@@ -333,6 +400,22 @@ reg_t syscall_t::sys_openat(reg_t dirfd, reg_t pname, reg_t len, reg_t flags, re
 {
   std::vector<char> name(len);
   memif->read(pname, len, name.data());
+
+  // target memory mapped from the file (see sys_mapfile) must not change
+  // with it, so it is copied first.  Writes and truncations all go through
+  // an fd opened here, since sys_mapfile maps no file that has one open.
+  // An async read still running could write into the pages after they are
+  // copied and be lost, so the workers are drained first.
+  struct stat st;
+  if ((flags & (O_WRONLY | O_RDWR | O_TRUNC))
+      && AT_SYSCALL(fstatat, dirfd, name.data(), &st, 0) == 0
+      && memif->maps_file(st.st_dev, st.st_ino)) {
+    if (workers)
+      workers->drain();
+    if (!memif->detach_file(st.st_dev, st.st_ino))
+      return -ENOMEM;
+  }
+
   int fd = sysret_errno(AT_SYSCALL(openat, dirfd, name.data(), flags, mode));
   if (fd < 0)
     return sysret_errno(-1);
@@ -495,16 +578,130 @@ reg_t syscall_t::sys_compressquery(reg_t id, reg_t a1, reg_t a2, reg_t a3, reg_t
   return 2;
 }
 
-void syscall_t::dispatch(reg_t mm)
+// Fills the target physical range [paddr, paddr + len) from the file fd
+// at offset, zeroing whatever lies past the end of the file.  The whole
+// file pages are mapped privately into target memory, so they are read on
+// first use and shared with the host page cache, and only the partial
+// page at the end of the file is copied.  A file the target has open for
+// writing is copied in full instead, since the target would see the
+// writes (or, were it truncated, fault on the mapped pages).  Returns the
+// number of bytes that came from the file.
+reg_t syscall_t::sys_mapfile(reg_t fd, reg_t offset, reg_t len, reg_t paddr, reg_t a4, reg_t a5, reg_t a6)
+{
+  if (offset % memif_t::DIRECT_PAGE_SIZE || paddr % memif_t::DIRECT_PAGE_SIZE)
+    return -EINVAL;
+
+  struct stat st;
+  int host_fd = fds.lookup(fd);
+  if (fstat(host_fd, &st) != 0)
+    return -errno;
+  if (!S_ISREG(st.st_mode))
+    return -ENODEV;
+
+  reg_t file_len = offset < reg_t(st.st_size) ? std::min(len, st.st_size - offset) : 0;
+  reg_t mapped = file_len & ~reg_t(memif_t::DIRECT_PAGE_SIZE - 1);
+  if (!mapped || fds.writable(st.st_dev, st.st_ino)
+      || !memif->map_file(paddr, mapped, host_fd, offset))
+    mapped = 0;
+
+  if (file_len > mapped) {
+    reg_t ret = do_io(fd, paddr + mapped, file_len - mapped, false, true, offset + mapped);
+    if (sreg_t(ret) < 0)
+      return ret;
+    file_len = mapped + ret;
+  }
+  memif->clear(paddr + file_len, len - file_len);
+  return file_len;
+}
+
+reg_t syscall_t::sys_ring_setup(reg_t addr, reg_t entries, reg_t a2, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
 {
-  target_endian<reg_t> magicmem[8];
-  memif->read(mm, sizeof(magicmem), magicmem);
+  if (ring_draining)
+    return -EBUSY;
+  if (addr == 0) {
+    ring_addr = ring_entries = 0;
+    return 0;
+  }
+  if (addr % sizeof(uint64_t) || entries == 0 || (entries & (entries - 1))
+      || entries > SYSCALL_RING_MAX_ENTRIES)
+    return -EINVAL;
 
+  ring_addr = addr;
+  ring_entries = entries;
+  return 0;
+}
+
+reg_t syscall_t::sys_ring_enter(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
+{
+  if (ring_draining)
+    return -EBUSY;
+  if (!ring_entries)
+    return -EINVAL;
+  return drain_ring();
+}
+
+void syscall_t::tick()
+{
+  if (workers)
+    workers->poll();
+  if (ring_entries)
+    drain_ring();
+}
+
+// Completes every posted call that the completion queue has room for, and
+// publishes the new sq_head and cq_tail once at the end.
+reg_t syscall_t::drain_ring()
+{
+  target_endian<uint64_t> header[4];
+  memif->read(ring_addr, sizeof(header), header);
+  uint64_t sq_head = host->from_target(header[0]);
+  uint64_t sq_tail = host->from_target(header[1]);
+  uint64_t cq_head = host->from_target(header[2]);
+  uint64_t cq_tail = host->from_target(header[3]);
+  if (sq_tail - sq_head > ring_entries || cq_tail - cq_head > ring_entries)
+    throw std::runtime_error("corrupt syscall ring");
+
+  addr_t sq = ring_addr + sizeof(syscall_ring_header);
+  addr_t cq = sq + ring_entries * sizeof(syscall_ring_sqe);
+  reg_t done = 0;
+  canonical_terminal_t::flush();
+  ring_draining = true;
+  while (sq_head != sq_tail && cq_tail - cq_head < ring_entries && !host->exit_code()) {
+    target_endian<uint64_t> sqe[9];
+    memif->read(sq + (sq_head & (ring_entries - 1)) * sizeof(syscall_ring_sqe), sizeof(sqe), sqe);
+    sq_head++;
+
+    target_endian<uint64_t> cqe[2] = {sqe[8], host->to_target(call(sqe))};
+    memif->write(cq + (cq_tail & (ring_entries - 1)) * sizeof(syscall_ring_cqe), sizeof(cqe), cqe);
+    cq_tail++;
+    done++;
+  }
+  ring_draining = false;
+
+  if (done) {
+    header[0] = host->to_target(sq_head);
+    header[3] = host->to_target(cq_tail);
+    memif->write(ring_addr, sizeof(header[0]), &header[0]);
+    memif->write(ring_addr + 3 * sizeof(header[0]), sizeof(header[3]), &header[3]);
+  }
+  return done;
+}
+
+reg_t syscall_t::call(const target_endian<reg_t> magicmem[8])
+{
   reg_t n = host->from_target(magicmem[0]);
   if (n >= table.size() || !table[n])
     throw std::runtime_error("bad syscall #" + std::to_string(n));
 
-  magicmem[0] = host->to_target((this->*table[n])(host->from_target(magicmem[1]), host->from_target(magicmem[2]), host->from_target(magicmem[3]), host->from_target(magicmem[4]), host->from_target(magicmem[5]), host->from_target(magicmem[6]), host->from_target(magicmem[7])));
+  return (this->*table[n])(host->from_target(magicmem[1]), host->from_target(magicmem[2]), host->from_target(magicmem[3]), host->from_target(magicmem[4]), host->from_target(magicmem[5]), host->from_target(magicmem[6]), host->from_target(magicmem[7]));
+}
+
+void syscall_t::dispatch(reg_t mm)
+{
+  target_endian<reg_t> magicmem[8];
+  memif->read(mm, sizeof(magicmem), magicmem);
+
+  magicmem[0] = host->to_target(call(magicmem));
 
   memif->write(mm, sizeof(magicmem), magicmem);
 }
@@ -535,6 +732,106 @@ int fds_t::lookup(reg_t fd)
   return fd >= fds.size() ? -1 : fds[fd];
 }
 
+bool fds_t::writable(dev_t dev, ino_t ino)
+{
+  struct stat st;
+  for (int fd : fds)
+    if (fd >= 0 && (fcntl(fd, F_GETFL) & O_ACCMODE) != O_RDONLY
+        && fstat(fd, &st) == 0 && st.st_dev == dev && st.st_ino == ino)
+      return true;
+  return false;
+}
+
+void syscall_t::set_async_io(unsigned nthreads)
+{
+  workers.reset(nthreads ? new io_workers_t(nthreads) : NULL);
+}
+
+void syscall_t::stop_async_io()
+{
+  workers.reset();
+}
+
+void syscall_t::complete_async(command_t cmd, reg_t ret)
+{
+  target_endian<reg_t> res = host->to_target(ret);
+  memif->write(cmd.payload(), sizeof(res), &res);
+  cmd.respond(1);
+}
+
+// Starts the calls that may block on the host on a worker thread, leaving
+// their tohost command unanswered until the result is written back from
+// tick().  Everything that touches target memory or the fd table stays on
+// the simulation thread.  Returns false for calls that dispatch() should
+// run right away.  The workers are handed dups of the target's fds, closed
+// again when the call completes, so that closing an fd (and the host
+// reusing its number) meanwhile cannot redirect a call in flight.
+bool syscall_t::dispatch_async(command_t cmd)
+{
+  target_endian<reg_t> magicmem[8];
+  memif->read(cmd.payload(), sizeof(magicmem), magicmem);
+  reg_t args[8];
+  for (int i = 0; i < 8; i++)
+    args[i] = host->from_target(magicmem[i]);
+
+  io_workers_t* w = workers.get();
+  switch (args[0]) {
+    case 63: case 64: case 67: case 68: { // read, write, pread, pwrite
+      bool write = args[0] == 64 || args[0] == 68;
+      bool positional = args[0] == 67 || args[0] == 68;
+      auto t = std::make_shared<io_transfer_t>();
+      io_prepare(*t, args[1], args[2], args[3], write, positional, args[4]);
+      t->fd = dup(t->fd);
+      workers->submit([t, w] { t->run(w); },
+                      [this, t, cmd] {
+                        close(t->fd);
+                        complete_async(cmd, io_finish(*t));
+                      });
+      return true;
+    }
+    case 71: { // sendfile
+      auto offset = std::make_shared<off_t>();
+      auto ret = std::make_shared<reg_t>();
+      reg_t poffset = args[3];
+      if (poffset)
+        memif->read(poffset, sizeof(*offset), offset.get());
+      int out_fd = dup(fds.lookup(args[1])), in_fd = dup(fds.lookup(args[2]));
+      size_t count = args[4];
+      workers->submit([=] {
+                        if (!w->wait_ready(in_fd, POLLIN) || !w->wait_ready(out_fd, POLLOUT))
+                          *ret = -EINTR;
+                        else
+                          *ret = sysret_errno(sendfile(out_fd, in_fd, poffset ? offset.get() : NULL, count));
+                      },
+                      [=] {
+                        close(out_fd);
+                        close(in_fd);
+                        if (sreg_t(*ret) >= 0 && poffset)
+                          memif->write(poffset, sizeof(*offset), offset.get());
+                        complete_async(cmd, *ret);
+                      });
+      return true;
+    }
+    case 80: { // fstat
+      auto buf = std::make_shared<struct stat>();
+      auto ret = std::make_shared<reg_t>();
+      int fd = dup(fds.lookup(args[1]));
+      reg_t pbuf = args[2];
+      workers->submit([=] { *ret = sysret_errno(fstat(fd, buf.get())); },
+                      [=] {
+                        close(fd);
+                        if (sreg_t(*ret) >= 0) {
+                          riscv_stat rbuf(*buf, host);
+                          memif->write(pbuf, sizeof(rbuf), &rbuf);
+                        }
+                        complete_async(cmd, *ret);
+                      });
+      return true;
+    }
+  }
+  return false;
+}
+
 void syscall_t::set_chroot(const char* where)
 {
   char buf1[PATH_MAX], buf2[PATH_MAX];
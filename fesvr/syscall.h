@@ -7,6 +7,8 @@
 #include "memif.h"
 #include "compress.h"
 #include "syscall_host.h"
+#include "io_workers.h"
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -19,17 +21,43 @@ class fds_t
   reg_t alloc(int fd);
   void dealloc(reg_t fd);
   int lookup(reg_t fd);
+  // true if one of the fds refers to the file dev:ino and may write to it
+  bool writable(dev_t dev, ino_t ino);
  private:
   std::vector<int> fds;
 };
 
+// A transfer between a host fd and a target buffer.  It is set up and
+// finished on the simulation thread; run() does only host I/O, so it may
+// happen on an io_workers_t thread in between.
+struct io_transfer_t
+{
+  int fd;
+  reg_t pbuf;
+  bool write;
+  bool positional;
+  reg_t off;
+  // the host spans of the target buffer, or the bounce buffer when it has none
+  std::vector<struct iovec> iov;
+  std::vector<char> bounce;
+  bool bounced;
+  sreg_t ret;
+
+  // waits for fd through workers, if given, so that they can stop it
+  void run(io_workers_t* workers = NULL);
+};
+
 class syscall_t : public device_t
 {
  public:
   syscall_t(syscall_host_t*);
 
   void set_chroot(const char* where);
-  
+  // runs blocking file calls on nthreads host threads, answering their
+  // tohost commands once they finish
+  void set_async_io(unsigned nthreads);
+  void stop_async_io();
+
  private:
   const char* identity() { return "syscall_proxy"; }
 
@@ -39,8 +67,26 @@ class syscall_t : public device_t
   fds_t fds;
   compressors_t compressors;
 
+  // reused by the synchronous I/O calls
+  io_transfer_t io;
+  void io_prepare(io_transfer_t& t, reg_t fd, reg_t pbuf, reg_t len, bool write, bool positional, reg_t off);
+  reg_t io_finish(io_transfer_t& t);
+  reg_t do_io(reg_t fd, reg_t pbuf, reg_t len, bool write, bool positional, reg_t off);
+
+  std::unique_ptr<io_workers_t> workers;
+  bool dispatch_async(command_t cmd);
+  void complete_async(command_t cmd, reg_t ret);
+
   void handle_syscall(command_t cmd);
   void dispatch(addr_t mm);
+  reg_t call(const target_endian<reg_t> magicmem[8]);
+
+  // the registered syscall ring (see syscall_ring.h), drained on every tick
+  void tick();
+  reg_t drain_ring();
+  addr_t ring_addr;
+  reg_t ring_entries;
+  bool ring_draining;
 
   std::string chroot;
   std::string do_chroot(const char* fn);
@@ -72,6 +118,9 @@ class syscall_t : public device_t
   reg_t sys_sendfile(reg_t, reg_t, reg_t, reg_t, reg_t, reg_t, reg_t);
   reg_t sys_compressfile(reg_t, reg_t, reg_t, reg_t, reg_t, reg_t, reg_t);
   reg_t sys_compressquery(reg_t, reg_t, reg_t, reg_t, reg_t, reg_t, reg_t);
+  reg_t sys_mapfile(reg_t, reg_t, reg_t, reg_t, reg_t, reg_t, reg_t);
+  reg_t sys_ring_setup(reg_t, reg_t, reg_t, reg_t, reg_t, reg_t, reg_t);
+  reg_t sys_ring_enter(reg_t, reg_t, reg_t, reg_t, reg_t, reg_t, reg_t);
 };
 
 #endif
@@ -20,6 +20,14 @@ class syscall_host_t
   virtual memif_t& memif() = 0;
   virtual const std::vector<std::string>& target_args() = 0;
 
+  // Resolves a target buffer to the host memory holding it, so system
+  // calls can do I/O on it in place; returns false if the buffer must be
+  // copied through memif() instead (e.g. because it is MMIO).
+  virtual bool host_spans(addr_t addr, size_t len, std::vector<struct iovec>& spans)
+  {
+    return memif().host_spans(addr, len, spans);
+  }
+
   template<typename T> inline T from_target(target_endian<T> n) const
   {
 #ifdef RISCV_ENABLE_DUAL_ENDIAN
@@ -0,0 +1,112 @@
+// See LICENSE for license details.
+
+#ifndef __SYSCALL_RING_H
+#define __SYSCALL_RING_H
+
+// Shared-memory submission/completion ring for proxied system calls.
+//
+// A target registers a ring once with the SYS_ring_setup proxied call
+// (through tohost as usual).  From then on it posts system calls by
+// filling submission entries and advancing sq_tail; the host drains every
+// posted entry in one pass each time it services the target, writes one
+// completion entry per call and advances cq_tail.  No tohost write is
+// needed per call; SYS_ring_enter makes the host drain the ring right away
+// instead of at its next pass.
+//
+// Layout at the (8-byte aligned) ring address, all words in target byte
+// order:
+//
+//   struct syscall_ring_header   header
+//   struct syscall_ring_sqe      sq[entries]
+//   struct syscall_ring_cqe      cq[entries]
+//
+// entries is a power of two no larger than SYSCALL_RING_MAX_ENTRIES.  The
+// head and tail counters run freely and are reduced modulo entries to
+// index sq and cq.  The target owns sq_tail and cq_head, the host sq_head
+// and cq_tail.  A submission entry starts with the same eight words as the
+// magic memory block of a tohost system call.  Entries complete in order,
+// and the host only consumes a submission while the completion queue has
+// room for its result.
+//
+// This header is plain C so that pk-style runtimes can include it as is.
+
+#include <stdint.h>
+
+#define SYS_ring_setup 2015   // (ring address, entries); 0 unregisters
+#define SYS_ring_enter 2016   // () -> number of calls completed
+
+#define SYSCALL_RING_MAX_ENTRIES 4096
+
+struct syscall_ring_header
+{
+  uint64_t sq_head;
+  uint64_t sq_tail;
+  uint64_t cq_head;
+  uint64_t cq_tail;
+};
+
+struct syscall_ring_sqe
+{
+  uint64_t n;
+  uint64_t args[7];
+  uint64_t user_data;
+};
+
+struct syscall_ring_cqe
+{
+  uint64_t user_data;
+  int64_t ret;
+};
+
+#define SYSCALL_RING_SIZE(entries) \
+  (sizeof(struct syscall_ring_header) + \
+   (entries) * (sizeof(struct syscall_ring_sqe) + sizeof(struct syscall_ring_cqe)))
+
+#if defined(__riscv) && !defined(__cplusplus)
+
+// Target-side helpers.  ring points at SYSCALL_RING_SIZE(entries) bytes of
+// memory that was zeroed before SYS_ring_setup.
+
+static inline struct syscall_ring_sqe* syscall_ring_sq(struct syscall_ring_header* ring)
+{
+  return (struct syscall_ring_sqe*)(ring + 1);
+}
+
+static inline struct syscall_ring_cqe* syscall_ring_cq(struct syscall_ring_header* ring, uint64_t entries)
+{
+  return (struct syscall_ring_cqe*)(syscall_ring_sq(ring) + entries);
+}
+
+// Posts one call; returns 0, or -1 if the submission queue is full.
+static inline int syscall_ring_submit(struct syscall_ring_header* ring, uint64_t entries,
+                                      uint64_t n, const uint64_t args[7], uint64_t user_data)
+{
+  uint64_t tail = ring->sq_tail;
+  if (tail - __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE) == entries)
+    return -1;
+
+  struct syscall_ring_sqe* sqe = &syscall_ring_sq(ring)[tail & (entries - 1)];
+  sqe->n = n;
+  for (int i = 0; i < 7; i++)
+    sqe->args[i] = args[i];
+  sqe->user_data = user_data;
+  __atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Takes the oldest completion; returns 0, or -1 if there is none yet.
+static inline int syscall_ring_reap(struct syscall_ring_header* ring, uint64_t entries,
+                                    struct syscall_ring_cqe* cqe)
+{
+  uint64_t head = ring->cq_head;
+  if (head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE))
+    return -1;
+
+  *cqe = syscall_ring_cq(ring, entries)[head & (entries - 1)];
+  __atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+#endif
+
+#endif
@@ -32,6 +32,36 @@ class canonical_termios_t
 
 static canonical_termios_t tios; // exit() will clean up for us
 
+class output_buffer_t
+{
+ public:
+  output_buffer_t() : len(0) {}
+  ~output_buffer_t() { flush(); }
+
+  void put(char ch)
+  {
+    buf[len++] = ch;
+    if (ch == '\n' || len == sizeof(buf))
+      flush();
+  }
+
+  void flush()
+  {
+    for (size_t done = 0; done < len; ) {
+      ssize_t ret = ::write(1, buf + done, len - done);
+      if (ret <= 0)
+        abort();
+      done += ret;
+    }
+    len = 0;
+  }
+ private:
+  char buf[4096];
+  size_t len;
+};
+
+static output_buffer_t output; // flushed at exit
+
 int canonical_terminal_t::read()
 {
   struct pollfd pfd;
@@ -48,6 +78,10 @@ int canonical_terminal_t::read()
 
 void canonical_terminal_t::write(char ch)
 {
-  if (::write(1, &ch, 1) != 1)
-    abort();
+  output.put(ch);
+}
+
+void canonical_terminal_t::flush()
+{
+  output.flush();
 }
@@ -5,7 +5,10 @@ class canonical_terminal_t
 {
  public:
   static int read();
+  // Output is buffered: it reaches stdout at the end of each line, when
+  // the buffer fills, on flush() and at exit.
   static void write(char);
+  static void flush();
 };
 
 #endif
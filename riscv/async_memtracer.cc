@@ -0,0 +1,115 @@
+// See LICENSE for license details.
+
+#include "async_memtracer.h"
+#include "common.h"
+#include <algorithm>
+#include <chrono>
+
+async_memtracer_t::async_memtracer_t()
+  : ring(new record_t[RING_ENTRIES]), head(0), tail(0)
+{
+}
+
+void async_memtracer_t::push(const record_t& r)
+{
+  size_t t = tail.load(std::memory_order_relaxed);
+  while (unlikely(t - head.load(std::memory_order_acquire) == RING_ENTRIES))
+    std::this_thread::yield();
+  ring[t % RING_ENTRIES] = r;
+  tail.store(t + 1, std::memory_order_release);
+}
+
+void async_memtracer_t::trace(uint64_t addr, size_t bytes, access_type type)
+{
+  push({{addr, (uint32_t)bytes, type}, OP_TRACE});
+}
+
+void async_memtracer_t::trace_batch(const memtrace_entry_t* entries, size_t n)
+{
+  // publish the batch with as few tail updates as the free space allows
+  size_t t = tail.load(std::memory_order_relaxed);
+  while (n) {
+    size_t space;
+    while ((space = RING_ENTRIES - (t - head.load(std::memory_order_acquire))) == 0)
+      std::this_thread::yield();
+    size_t chunk = std::min(space, n);
+    for (size_t i = 0; i < chunk; i++)
+      ring[(t + i) % RING_ENTRIES] = {entries[i], OP_TRACE};
+    t += chunk;
+    tail.store(t, std::memory_order_release);
+    entries += chunk;
+    n -= chunk;
+  }
+}
+
+void async_memtracer_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval)
+{
+  op_t op = clean && inval ? OP_CLEAN_INVAL : clean ? OP_CLEAN : OP_INVAL;
+  push({{addr, (uint32_t)bytes, LOAD}, op});
+}
+
+size_t async_memtracer_t::drain()
+{
+  size_t h = head.load(std::memory_order_relaxed);
+  size_t t = tail.load(std::memory_order_acquire);
+
+  for (size_t i = h; i != t; i++) {
+    const record_t& r = ring[i % RING_ENTRIES];
+    if (likely(r.op == OP_TRACE))
+      downstream.trace(r.entry.addr, r.entry.bytes, r.entry.type);
+    else
+      downstream.clean_invalidate(r.entry.addr, r.entry.bytes,
+                                  r.op != OP_INVAL, r.op != OP_CLEAN);
+  }
+
+  head.store(t, std::memory_order_release);
+  return t - h;
+}
+
+memtracer_worker_t::memtracer_worker_t()
+  : done(false)
+{
+}
+
+memtracer_worker_t::~memtracer_worker_t()
+{
+  if (thread.joinable()) {
+    done.store(true, std::memory_order_release);
+    thread.join();
+  }
+}
+
+async_memtracer_t* memtracer_worker_t::new_tracer()
+{
+  tracers.emplace_back(new async_memtracer_t());
+  return tracers.back().get();
+}
+
+void memtracer_worker_t::start()
+{
+  thread = std::thread(&memtracer_worker_t::run, this);
+}
+
+void memtracer_worker_t::run()
+{
+  unsigned idle = 0;
+  while (true) {
+    // read done before draining, so that nothing pushed before the flag was
+    // set can be left behind
+    bool stopping = done.load(std::memory_order_acquire);
+
+    size_t consumed = 0;
+    for (auto& t : tracers)
+      consumed += t->drain();
+
+    if (consumed) {
+      idle = 0;
+    } else if (stopping) {
+      break;
+    } else if (++idle < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+}
@@ -0,0 +1,90 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_ASYNC_MEMTRACER_H
+#define _RISCV_ASYNC_MEMTRACER_H
+
+#include "memtracer.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Runs memory tracers (e.g. the cache models) on a separate thread.  Each
+// hart gets its own async_memtracer_t, which pushes access records into a
+// single-producer/single-consumer ring; one worker thread drains all of the
+// rings and drives the downstream tracers.  The accesses of each hart reach
+// the tracers in program order, but the accesses of different harts are only
+// interleaved at batch granularity.
+class async_memtracer_t : public memtracer_t
+{
+ public:
+  async_memtracer_t();
+
+  void hook(memtracer_t* t) { downstream.hook(t); }
+
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return downstream.interested_in_range(begin, end, type);
+  }
+  // the downstream tracers only ever see this tracer's records
+  bool independent() { return true; }
+  void trace(uint64_t addr, size_t bytes, access_type type);
+  void trace_batch(const memtrace_entry_t* entries, size_t n);
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval);
+
+ private:
+  enum op_t : uint8_t {
+    OP_TRACE,
+    OP_CLEAN,
+    OP_INVAL,
+    OP_CLEAN_INVAL,
+  };
+
+  struct record_t {
+    memtrace_entry_t entry;
+    op_t op;
+  };
+
+  static const size_t RING_ENTRIES = 1 << 16;
+
+  void push(const record_t& r);
+  // hands everything queued so far to the downstream tracers; only called
+  // from the worker thread.  Returns the number of records consumed.
+  size_t drain();
+  bool empty() const
+  {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+
+  memtracer_list_t downstream;
+  std::unique_ptr<record_t[]> ring;
+
+  // head is written only by the consumer, tail only by the producer; keep
+  // them on separate cache lines so the two threads don't ping-pong.
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+
+  friend class memtracer_worker_t;
+};
+
+class memtracer_worker_t
+{
+ public:
+  memtracer_worker_t();
+  // drains every ring before stopping the worker thread
+  ~memtracer_worker_t();
+
+  // returns a new per-hart tracer served by this worker
+  async_memtracer_t* new_tracer();
+  // starts the worker thread; no tracers may be added afterwards
+  void start();
+
+ private:
+  void run();
+
+  std::vector<std::unique_ptr<async_memtracer_t>> tracers;
+  std::thread thread;
+  std::atomic<bool> done;
+};
+
+#endif
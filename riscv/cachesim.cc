@@ -6,18 +6,120 @@
 #include <iostream>
 #include <iomanip>
 
-cache_sim_t::cache_sim_t(size_t _sets, size_t _ways, size_t _linesz, const char* _name)
-: sets(_sets), ways(_ways), linesz(_linesz), name(_name), log(false)
+repl_policy_t* repl_policy_t::construct(const char* name, size_t sets, size_t ways)
 {
-  init();
+  if (!strcmp(name, "random"))
+    return new random_repl_policy_t(ways);
+  if (!strcmp(name, "lru"))
+    return new lru_repl_policy_t(sets, ways);
+  if (!strcmp(name, "plru") && (ways & (ways-1)) == 0)
+    return new plru_repl_policy_t(sets, ways);
+  if (!strcmp(name, "srrip"))
+    return new rrip_repl_policy_t(sets, ways, false);
+  if (!strcmp(name, "brrip"))
+    return new rrip_repl_policy_t(sets, ways, true);
+  return NULL;
+}
+
+lru_repl_policy_t::lru_repl_policy_t(size_t sets, size_t _ways)
+  : ways(_ways), prev(sets*ways), next(sets*ways), head(sets, 0), tail(sets, ways-1)
+{
+  for (size_t i = 0; i < sets; i++) {
+    for (size_t j = 0; j < ways; j++) {
+      prev[i*ways + j] = j - 1;
+      next[i*ways + j] = j + 1;
+    }
+  }
+}
+
+void lru_repl_policy_t::touch(size_t set, size_t way)
+{
+  if (head[set] == way)
+    return;
+
+  uint32_t* p = &prev[set*ways];
+  uint32_t* n = &next[set*ways];
+
+  // unlink way; it isn't the head, so it has a predecessor
+  n[p[way]] = n[way];
+  if (tail[set] == way)
+    tail[set] = p[way];
+  else
+    p[n[way]] = p[way];
+
+  n[way] = head[set];
+  p[head[set]] = way;
+  head[set] = way;
+}
+
+plru_repl_policy_t::plru_repl_policy_t(size_t sets, size_t _ways)
+  : ways(_ways), levels(0), bits(sets*ways)
+{
+  for (size_t x = ways; x > 1; x >>= 1)
+    levels++;
+}
+
+void plru_repl_policy_t::touch(size_t set, size_t way)
+{
+  uint8_t* tree = &bits[set*ways];
+  size_t node = 0;
+  for (size_t l = 0; l < levels; l++) {
+    size_t dir = (way >> (levels-1-l)) & 1;
+    tree[node] = !dir; // point away from the way just used
+    node = 2*node + 1 + dir;
+  }
+}
+
+size_t plru_repl_policy_t::victim(size_t set)
+{
+  uint8_t* tree = &bits[set*ways];
+  size_t node = 0, way = 0;
+  for (size_t l = 0; l < levels; l++) {
+    size_t dir = tree[node];
+    way = (way << 1) | dir;
+    node = 2*node + 1 + dir;
+  }
+  return way;
+}
+
+rrip_repl_policy_t::rrip_repl_policy_t(size_t sets, size_t _ways, bool _bimodal)
+  : ways(_ways), bimodal(_bimodal), rrpv(sets*ways, RRPV_MAX)
+{
+}
+
+size_t rrip_repl_policy_t::victim(size_t set)
+{
+  uint8_t* r = &rrpv[set*ways];
+  while (true) {
+    for (size_t i = 0; i < ways; i++)
+      if (r[i] == RRPV_MAX)
+        return i;
+    for (size_t i = 0; i < ways; i++)
+      r[i]++;
+  }
+}
+
+void rrip_repl_policy_t::fill(size_t set, size_t way)
+{
+  bool distant = bimodal && lfsr.next() % BIP_PERIOD != 0;
+  rrpv[set*ways + way] = distant ? RRPV_MAX : RRPV_MAX - 1;
+}
+
+cache_sim_t::cache_sim_t(size_t _sets, size_t _ways, size_t _linesz, const char* _name,
+                         const char* _policy)
+: sets(_sets), ways(_ways), linesz(_linesz), name(_name), log(false), quiet(false)
+{
+  init(_policy);
 }
 
 static void help()
 {
   std::cerr << "Cache configurations must be of the form" << std::endl;
-  std::cerr << "  sets:ways:blocksize" << std::endl;
+  std::cerr << "  sets:ways:blocksize[:policy]" << std::endl;
   std::cerr << "where sets, ways, and blocksize are positive integers, with" << std::endl;
-  std::cerr << "sets and blocksize both powers of two and blocksize at least 8." << std::endl;
+  std::cerr << "sets and blocksize both powers of two and blocksize at least 8," << std::endl;
+  std::cerr << "and policy is one of random (the default), lru, plru, srrip," << std::endl;
+  std::cerr << "or brrip.  plru requires ways to be a power of two." << std::endl;
   exit(1);
 }
 
@@ -27,23 +129,33 @@ cache_sim_t* cache_sim_t::construct(const char* config, const char* name)
   if (!wp++) help();
   const char* bp = strchr(wp, ':');
   if (!bp++) help();
+  const char* pp = strchr(bp, ':');
 
   size_t sets = atoi(std::string(config, wp).c_str());
   size_t ways = atoi(std::string(wp, bp).c_str());
   size_t linesz = atoi(bp);
+  const char* policy = pp ? pp + 1 : "random";
+
+  if (ways == 0)
+    help();
 
   if (ways > 4 /* empirical */ && sets == 1)
-    return new fa_cache_sim_t(ways, linesz, name);
-  return new cache_sim_t(sets, ways, linesz, name);
+    return new fa_cache_sim_t(ways, linesz, name, policy);
+  return new cache_sim_t(sets, ways, linesz, name, policy);
 }
 
-void cache_sim_t::init()
+void cache_sim_t::init(const char* policy_name)
 {
   if(sets == 0 || (sets & (sets-1)))
     help();
   if(linesz < 8 || (linesz & (linesz-1)))
     help();
 
+  policy = repl_policy_t::construct(policy_name, sets, ways);
+  if (!policy)
+    help();
+  fill_invalid_first = strcmp(policy_name, "random") != 0;
+
   idx_shift = 0;
   for (size_t x = linesz; x>1; x >>= 1)
     idx_shift++;
@@ -56,30 +168,76 @@ void cache_sim_t::init()
   write_misses = 0;
   bytes_written = 0;
   writebacks = 0;
+  invalidations = 0;
 
   miss_handler = NULL;
+  peers = NULL;
+  inner = NULL;
 }
 
 cache_sim_t::cache_sim_t(const cache_sim_t& rhs)
  : sets(rhs.sets), ways(rhs.ways), linesz(rhs.linesz),
-   idx_shift(rhs.idx_shift), name(rhs.name), log(false)
+   idx_shift(rhs.idx_shift), name(rhs.name), log(false), quiet(false)
 {
+  policy = rhs.policy->clone();
+  fill_invalid_first = rhs.fill_invalid_first;
+  peers = inner = NULL;
   tags = new uint64_t[sets*ways];
   memcpy(tags, rhs.tags, sets*ways*sizeof(uint64_t));
 }
 
 cache_sim_t::~cache_sim_t()
 {
-  print_stats();
+  if (!quiet)
+    print_stats();
   delete [] tags;
+  delete policy;
+}
+
+float cache_sim_t::miss_rate() const
+{
+  if(read_accesses + write_accesses == 0)
+    return 0;
+  return 100.0f*(read_misses+write_misses)/(read_accesses+write_accesses);
+}
+
+float cache_sim_t::miss_rate(const std::vector<cache_sim_t*>& caches)
+{
+  uint64_t accesses = 0, misses = 0;
+  for (auto c : caches) {
+    accesses += c->read_accesses + c->write_accesses;
+    misses += c->read_misses + c->write_misses;
+  }
+  return accesses ? 100.0f*misses/accesses : 0;
 }
 
 void cache_sim_t::print_stats()
 {
+  print_stats(name, {this});
+}
+
+void cache_sim_t::print_stats(const std::string& name, const std::vector<cache_sim_t*>& caches)
+{
+  uint64_t read_accesses = 0, read_misses = 0, bytes_read = 0;
+  uint64_t write_accesses = 0, write_misses = 0, bytes_written = 0;
+  uint64_t writebacks = 0, invalidations = 0;
+  bool coherent = false;
+  for (auto c : caches) {
+    read_accesses += c->read_accesses;
+    read_misses += c->read_misses;
+    bytes_read += c->bytes_read;
+    write_accesses += c->write_accesses;
+    write_misses += c->write_misses;
+    bytes_written += c->bytes_written;
+    writebacks += c->writebacks;
+    invalidations += c->invalidations;
+    coherent |= c->peers != NULL;
+  }
+
   if(read_accesses + write_accesses == 0)
     return;
 
-  float mr = 100.0f*(read_misses+write_misses)/(read_accesses+write_accesses);
+  float mr = miss_rate(caches);
 
   std::cout << std::setprecision(3) << std::fixed;
   std::cout << name << " ";
@@ -96,6 +254,10 @@ void cache_sim_t::print_stats()
   std::cout << "Write Misses:          " << write_misses << std::endl;
   std::cout << name << " ";
   std::cout << "Writebacks:            " << writebacks << std::endl;
+  if (coherent) {
+    std::cout << name << " ";
+    std::cout << "Invalidations:         " << invalidations << std::endl;
+  }
   std::cout << name << " ";
   std::cout << "Miss Rate:             " << mr << '%' << std::endl;
 }
@@ -115,9 +277,19 @@ uint64_t* cache_sim_t::check_tag(uint64_t addr)
 uint64_t cache_sim_t::victimize(uint64_t addr)
 {
   size_t idx = (addr >> idx_shift) & (sets-1);
-  size_t way = lfsr.next() % ways;
+  size_t way = ways;
+  if (fill_invalid_first)
+    for (size_t i = 0; i < ways; i++)
+      if (!(tags[idx*ways + i] & VALID)) {
+        way = i;
+        break;
+      }
+  if (way == ways)
+    way = policy->victim(idx);
+
   uint64_t victim = tags[idx*ways + way];
   tags[idx*ways + way] = (addr >> idx_shift) | VALID;
+  policy->fill(idx, way);
   return victim;
 }
 
@@ -129,8 +301,14 @@ void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
   uint64_t* hit_way = check_tag(addr);
   if (likely(hit_way != NULL))
   {
-    if (store)
+    size_t pos = hit_way - tags;
+    policy->touch(pos / ways, pos % ways);
+    if (store) {
+      // a store to a shared line must first invalidate the other copies
+      if (unlikely(peers && !(*hit_way & DIRTY)))
+        snoop(addr, true);
       *hit_way |= DIRTY;
+    }
     return;
   }
 
@@ -142,7 +320,16 @@ void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
               << std::hex << addr << std::endl;
   }
 
+  if (peers)
+    snoop(addr, store);
+
   uint64_t victim = victimize(addr);
+  // mark the line just filled now: the accesses below may evict lines from
+  // this cache through the miss handler's back-invalidation
+  if (store)
+    *check_tag(addr) |= DIRTY;
+  if (inner && (victim & VALID))
+    victim |= back_invalidate(victim);
 
   if ((victim & (VALID | DIRTY)) == (VALID | DIRTY))
   {
@@ -154,9 +341,53 @@ void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
 
   if (miss_handler)
     miss_handler->access(addr & ~(linesz-1), linesz, false);
+}
 
-  if (store)
-    *check_tag(addr) |= DIRTY;
+void cache_sim_t::snoop(uint64_t addr, bool store)
+{
+  // MSI: a load downgrades a modified copy in another cache to shared, and
+  // a store invalidates every other copy.  Modified data is written back.
+  for (auto c : *peers) {
+    if (c == this)
+      continue;
+
+    uint64_t* tag = c->check_tag(addr);
+    if (!tag)
+      continue;
+
+    if (*tag & DIRTY) {
+      *tag &= ~DIRTY;
+      c->writebacks++;
+      if (c->miss_handler)
+        c->miss_handler->access(addr & ~(c->linesz-1), c->linesz, true);
+    }
+    if (store) {
+      *tag &= ~VALID;
+      c->invalidations++;
+    }
+  }
+}
+
+uint64_t cache_sim_t::back_invalidate(uint64_t victim)
+{
+  // keep the inner caches included: drop every copy of the evicted line,
+  // and make the eviction write back if any of them was modified
+  uint64_t start = (victim & ~(VALID | DIRTY)) << idx_shift;
+  uint64_t dirty = 0;
+  for (auto c : *inner) {
+    for (uint64_t a = start; a < start + linesz; a += c->linesz) {
+      uint64_t* tag = c->check_tag(a);
+      if (!tag)
+        continue;
+      if (*tag & DIRTY) {
+        c->writebacks++;
+        dirty = DIRTY;
+      }
+      *tag &= ~(VALID | DIRTY);
+      c->invalidations++;
+    }
+  }
+  return dirty;
 }
 
 void cache_sim_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval)
@@ -165,9 +396,32 @@ void cache_sim_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool
   uint64_t end_addr = (addr + bytes + linesz-1) & ~(linesz-1);
   uint64_t cur_addr = start_addr;
   while (cur_addr < end_addr) {
+    // the operation applies to every copy of the line: the other private
+    // caches at this level, and the inner caches a shared cache includes
+    if (peers) {
+      for (auto c : *peers) {
+        if (c == this)
+          continue;
+        uint64_t* tag = c->check_tag(cur_addr);
+        if (!tag)
+          continue;
+        if (clean && (*tag & DIRTY)) {
+          c->writebacks++;
+          *tag &= ~DIRTY;
+        }
+        if (inval) {
+          *tag &= ~(VALID | DIRTY);
+          c->invalidations++;
+        }
+      }
+    }
+
     uint64_t* hit_way = check_tag(cur_addr);
     if (likely(hit_way != NULL))
     {
+      if (inner && inval)
+        *hit_way |= back_invalidate(*hit_way);
+
       if (clean) {
         if (*hit_way & DIRTY) {
           writebacks++;
@@ -184,27 +438,167 @@ void cache_sim_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool
     miss_handler->clean_invalidate(addr, bytes, clean, inval);
 }
 
-fa_cache_sim_t::fa_cache_sim_t(size_t ways, size_t linesz, const char* name)
-  : cache_sim_t(1, ways, linesz, name)
+fa_cache_sim_t::fa_cache_sim_t(size_t ways, size_t linesz, const char* name,
+                               const char* policy)
+  : cache_sim_t(1, ways, linesz, name, policy), used_ways(0)
 {
+  way_of.reserve(ways);
 }
 
 uint64_t* fa_cache_sim_t::check_tag(uint64_t addr)
 {
-  auto it = tags.find(addr >> idx_shift);
-  return it == tags.end() ? NULL : &it->second;
+  auto it = way_of.find(addr >> idx_shift);
+  if (it == way_of.end() || !(tags[it->second] & VALID))
+    return NULL;
+  return &tags[it->second];
 }
 
 uint64_t fa_cache_sim_t::victimize(uint64_t addr)
 {
-  uint64_t old_tag = 0;
-  if (tags.size() == ways)
-  {
-    auto it = tags.begin();
-    std::advance(it, lfsr.next() % ways);
-    old_tag = it->second;
-    tags.erase(it);
+  uint64_t line = addr >> idx_shift;
+  size_t way;
+
+  auto it = way_of.find(line);
+  if (it != way_of.end()) {
+    // the line was invalidated but still owns a way; reuse it
+    way = it->second;
+  } else {
+    // the tag array is indexed by way, so the victim is found in O(1)
+    way = used_ways < ways ? used_ways++ : policy->victim(0);
+    auto old = way_of.find(tags[way] & ~(VALID | DIRTY));
+    if (old != way_of.end() && old->second == way)
+      way_of.erase(old);
+    way_of[line] = way;
+  }
+
+  uint64_t victim = tags[way];
+  tags[way] = line | VALID;
+  policy->fill(0, way);
+  return victim;
+}
+
+static std::vector<std::string> split_configs(const char* configs)
+{
+  // an absent level is represented by a single empty configuration
+  std::vector<std::string> res;
+  if (!configs) {
+    res.push_back("");
+    return res;
+  }
+
+  std::string list(configs);
+  size_t pos = 0, comma;
+  while ((comma = list.find(',', pos)) != std::string::npos) {
+    res.push_back(list.substr(pos, comma - pos));
+    pos = comma + 1;
+  }
+  res.push_back(list.substr(pos));
+  return res;
+}
+
+template <class T>
+static std::vector<cache_sim_t*> l1s_of(const std::vector<std::unique_ptr<T>>& sims)
+{
+  std::vector<cache_sim_t*> res;
+  for (auto& s : sims)
+    res.push_back(s->get_cache());
+  return res;
+}
+
+cache_sweep_t::cache_sweep_t(const char* ic_configs, const char* dc_configs,
+                             const char* l2_configs, size_t _nprocs, bool log)
+  : nprocs(_nprocs)
+{
+  auto ics = split_configs(ic_configs);
+  auto dcs = split_configs(dc_configs);
+  auto l2s = split_configs(l2_configs);
+
+  points.resize(ics.size() * dcs.size() * l2s.size());
+  bool quiet = points.size() > 1;
+
+  size_t n = 0;
+  for (auto& ic : ics) {
+    for (auto& dc : dcs) {
+      for (auto& l2 : l2s) {
+        point_t& p = points[n++];
+        p.ic_config = ic;
+        p.dc_config = dc;
+        p.l2_config = l2;
+        if (!l2.empty()) {
+          p.l2.reset(cache_sim_t::construct(l2.c_str(), "L2$"));
+          p.l2->set_quiet(quiet);
+        }
+        for (size_t i = 0; i < nprocs; i++) {
+          // with one hart, keep the names the statistics have always had
+          std::string suffix = nprocs > 1 ? std::to_string(i) : "";
+          if (!ic.empty()) {
+            p.ic.emplace_back(new icache_sim_t(ic.c_str(), ("I$" + suffix).c_str()));
+            p.l1s.push_back(p.ic.back()->get_cache());
+          }
+          if (!dc.empty()) {
+            p.dc.emplace_back(new dcache_sim_t(dc.c_str(), ("D$" + suffix).c_str()));
+            p.l1s.push_back(p.dc.back()->get_cache());
+          }
+        }
+        for (auto c : p.l1s) {
+          c->set_quiet(quiet);
+          c->set_log(log);
+          if (p.l2)
+            c->set_miss_handler(&*p.l2);
+          if (nprocs > 1)
+            c->set_peers(&p.l1s);
+        }
+        if (p.l2 && nprocs > 1)
+          p.l2->set_inner(&p.l1s);
+      }
+    }
+  }
+}
+
+cache_sweep_t::~cache_sweep_t()
+{
+  if (points.size() > 1) {
+    print_table();
+  } else if (nprocs > 1) {
+    // each hart's caches, then the totals; the L2 prints its own statistics
+    // as it is destroyed
+    auto& p = points[0];
+    auto ics = l1s_of(p.ic), dcs = l1s_of(p.dc);
+    for (size_t i = 0; i < nprocs; i++) {
+      for (auto l1s : {&ics, &dcs}) {
+        if (!l1s->empty()) {
+          (*l1s)[i]->print_stats();
+          (*l1s)[i]->set_quiet(true);
+        }
+      }
+    }
+    cache_sim_t::print_stats("I$", ics);
+    cache_sim_t::print_stats("D$", dcs);
+  }
+}
+
+void cache_sweep_t::print_table()
+{
+  auto column = [](const std::string& config, const std::vector<cache_sim_t*>& caches) {
+    std::cout << std::left << std::setw(22) << (config.empty() ? "-" : config)
+              << std::right;
+    if (!caches.empty())
+      std::cout << std::setw(9) << cache_sim_t::miss_rate(caches) << '%';
+    else
+      std::cout << std::setw(10) << "-";
+  };
+
+  std::cout << std::setprecision(3) << std::fixed;
+  std::cout << std::left
+            << std::setw(22) << "I$" << std::setw(12) << "Miss Rate"
+            << std::setw(22) << "D$" << std::setw(12) << "Miss Rate"
+            << std::setw(22) << "L2$" << "Miss Rate" << std::endl;
+  for (auto& p : points) {
+    column(p.ic_config, l1s_of(p.ic));
+    std::cout << "  ";
+    column(p.dc_config, l1s_of(p.dc));
+    std::cout << "  ";
+    column(p.l2_config, p.l2 ? std::vector<cache_sim_t*>{p.l2.get()} : std::vector<cache_sim_t*>());
+    std::cout << std::endl;
   }
-  tags[addr >> idx_shift] = (addr >> idx_shift) | VALID;
-  return old_tag;
 }
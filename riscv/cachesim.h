@@ -5,8 +5,10 @@
 
 #include "memtracer.h"
 #include <cstring>
+#include <memory>
 #include <string>
-#include <map>
+#include <vector>
+#include <unordered_map>
 #include <cstdint>
 
 class lfsr_t
@@ -19,18 +21,107 @@ class lfsr_t
   uint32_t reg;
 };
 
+// Chooses which way of a set to evict.  touch() is called on every hit,
+// victim() picks the way to replace on a miss, and fill() is called once the
+// new line has been installed in that way.
+class repl_policy_t
+{
+ public:
+  virtual ~repl_policy_t() {}
+  virtual void touch(size_t set, size_t way) = 0;
+  virtual size_t victim(size_t set) = 0;
+  virtual void fill(size_t set, size_t way) { touch(set, way); }
+  virtual repl_policy_t* clone() const = 0;
+
+  // name is one of random, lru, plru, srrip or brrip; returns NULL otherwise
+  static repl_policy_t* construct(const char* name, size_t sets, size_t ways);
+};
+
+class random_repl_policy_t : public repl_policy_t
+{
+ public:
+  random_repl_policy_t(size_t ways) : ways(ways) {}
+  void touch(size_t set, size_t way) {}
+  size_t victim(size_t set) { return lfsr.next() % ways; }
+  repl_policy_t* clone() const { return new random_repl_policy_t(*this); }
+ private:
+  lfsr_t lfsr;
+  size_t ways;
+};
+
+// true LRU, kept as a doubly-linked recency list per set so that both
+// touch() and victim() are O(1), even for fully-associative caches
+class lru_repl_policy_t : public repl_policy_t
+{
+ public:
+  lru_repl_policy_t(size_t sets, size_t ways);
+  void touch(size_t set, size_t way);
+  size_t victim(size_t set) { return tail[set]; }
+  repl_policy_t* clone() const { return new lru_repl_policy_t(*this); }
+ private:
+  size_t ways;
+  std::vector<uint32_t> prev, next; // indexed by set*ways + way
+  std::vector<uint32_t> head, tail; // most and least recently used way
+};
+
+// tree pseudo-LRU; ways must be a power of two
+class plru_repl_policy_t : public repl_policy_t
+{
+ public:
+  plru_repl_policy_t(size_t sets, size_t ways);
+  void touch(size_t set, size_t way);
+  size_t victim(size_t set);
+  repl_policy_t* clone() const { return new plru_repl_policy_t(*this); }
+ private:
+  size_t ways;
+  size_t levels;
+  std::vector<uint8_t> bits; // ways-1 tree nodes per set, heap-ordered
+};
+
+// 2-bit static (SRRIP) or bimodal (BRRIP) re-reference interval prediction
+class rrip_repl_policy_t : public repl_policy_t
+{
+ public:
+  rrip_repl_policy_t(size_t sets, size_t ways, bool bimodal);
+  void touch(size_t set, size_t way) { rrpv[set*ways + way] = 0; }
+  size_t victim(size_t set);
+  void fill(size_t set, size_t way);
+  repl_policy_t* clone() const { return new rrip_repl_policy_t(*this); }
+ private:
+  static constexpr uint8_t RRPV_MAX = 3;
+  // BRRIP inserts at RRPV_MAX-1 only once every BIP_PERIOD fills
+  static constexpr uint32_t BIP_PERIOD = 32;
+  size_t ways;
+  bool bimodal;
+  lfsr_t lfsr;
+  std::vector<uint8_t> rrpv;
+};
+
 class cache_sim_t
 {
  public:
-  cache_sim_t(size_t sets, size_t ways, size_t linesz, const char* name);
+  cache_sim_t(size_t sets, size_t ways, size_t linesz, const char* name,
+              const char* policy = "random");
   cache_sim_t(const cache_sim_t& rhs);
   virtual ~cache_sim_t();
 
   void access(uint64_t addr, size_t bytes, bool store);
   void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval);
   void print_stats();
+  float miss_rate() const;
+  // statistics summed over several caches, e.g. the private L1s of all harts
+  static void print_stats(const std::string& name, const std::vector<cache_sim_t*>& caches);
+  static float miss_rate(const std::vector<cache_sim_t*>& caches);
   void set_miss_handler(cache_sim_t* mh) { miss_handler = mh; }
+  // peers are the private caches at this level, this one included, which
+  // are kept coherent with one another by MSI invalidation
+  void set_peers(const std::vector<cache_sim_t*>* p) { peers = p; }
+  // inner are the private caches this shared cache includes; lines it
+  // evicts are invalidated there too
+  void set_inner(const std::vector<cache_sim_t*>* i) { inner = i; }
   void set_log(bool _log) { log = _log; }
+  // don't print statistics on destruction
+  void set_quiet(bool _quiet) { quiet = _quiet; }
 
   static cache_sim_t* construct(const char* config, const char* name);
 
@@ -41,8 +132,16 @@ class cache_sim_t
   virtual uint64_t* check_tag(uint64_t addr);
   virtual uint64_t victimize(uint64_t addr);
 
-  lfsr_t lfsr;
+  void snoop(uint64_t addr, bool store);
+  uint64_t back_invalidate(uint64_t victim);
+
+  repl_policy_t* policy;
+  // the random policy evicts valid lines too, as it always has; the others
+  // fill invalid ways first
+  bool fill_invalid_first;
   cache_sim_t* miss_handler;
+  const std::vector<cache_sim_t*>* peers;
+  const std::vector<cache_sim_t*>* inner;
 
   size_t sets;
   size_t ways;
@@ -58,22 +157,27 @@ class cache_sim_t
   uint64_t write_misses;
   uint64_t bytes_written;
   uint64_t writebacks;
+  uint64_t invalidations;
 
   std::string name;
   bool log;
+  bool quiet;
 
-  void init();
+  void init(const char* policy);
 };
 
+// Fully-associative cache.  Lines live in the ordinary tag array (a single
+// set), and a hash map from line address to way makes lookups O(1).
 class fa_cache_sim_t : public cache_sim_t
 {
  public:
-  fa_cache_sim_t(size_t ways, size_t linesz, const char* name);
+  fa_cache_sim_t(size_t ways, size_t linesz, const char* name,
+                 const char* policy = "random");
   uint64_t* check_tag(uint64_t addr);
   uint64_t victimize(uint64_t addr);
  private:
-  static bool cmp(uint64_t a, uint64_t b);
-  std::map<uint64_t, uint64_t> tags;
+  std::unordered_map<uint64_t, size_t> way_of;
+  size_t used_ways;
 };
 
 class cache_memtracer_t : public memtracer_t
@@ -99,6 +203,7 @@ class cache_memtracer_t : public memtracer_t
   {
     cache->set_log(log);
   }
+  cache_sim_t* get_cache() { return cache; }
 
  protected:
   cache_sim_t* cache;
@@ -107,7 +212,7 @@ class cache_memtracer_t : public memtracer_t
 class icache_sim_t : public cache_memtracer_t
 {
  public:
-  icache_sim_t(const char* config) : cache_memtracer_t(config, "I$") {}
+  icache_sim_t(const char* config, const char* name = "I$") : cache_memtracer_t(config, name) {}
   bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
   {
     return type == FETCH;
@@ -121,7 +226,7 @@ class icache_sim_t : public cache_memtracer_t
 class dcache_sim_t : public cache_memtracer_t
 {
  public:
-  dcache_sim_t(const char* config) : cache_memtracer_t(config, "D$") {}
+  dcache_sim_t(const char* config, const char* name = "D$") : cache_memtracer_t(config, name) {}
   bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
   {
     return type == LOAD || type == STORE;
@@ -132,4 +237,36 @@ class dcache_sim_t : public cache_memtracer_t
   }
 };
 
+// The cache hierarchies selected by --ic, --dc and --l2.  Each option takes
+// a comma-separated list of configurations, and one hierarchy is built for
+// every combination, so a whole design-space sweep is driven by a single
+// access stream.  With more than one hierarchy, the usual per-cache
+// statistics are replaced by a table of miss rates.
+//
+// Every hart gets private L1 caches.  With several harts, the L1s are kept
+// coherent with one another, and an L2 is shared by all of them and
+// includes them.
+class cache_sweep_t
+{
+ public:
+  struct point_t {
+    std::string ic_config, dc_config, l2_config;
+    std::vector<std::unique_ptr<icache_sim_t>> ic; // indexed by hart
+    std::vector<std::unique_ptr<dcache_sim_t>> dc;
+    std::unique_ptr<cache_sim_t> l2;
+    std::vector<cache_sim_t*> l1s; // all of the above L1s
+  };
+
+  cache_sweep_t(const char* ic_configs, const char* dc_configs,
+                const char* l2_configs, size_t nprocs, bool log);
+  ~cache_sweep_t();
+
+  std::vector<point_t>& get_points() { return points; }
+  void print_table();
+
+ private:
+  std::vector<point_t> points;
+  size_t nprocs;
+};
+
 #endif
@@ -0,0 +1,66 @@
+// See LICENSE for license details.
+
+#include "commit_log_writer.h"
+#include <cstring>
+
+commit_log_writer_t::commit_log_writer_t(FILE* file)
+  : file(file), queued_bytes(0), done(false)
+{
+  fwrite(COMMIT_LOG_MAGIC, 1, strlen(COMMIT_LOG_MAGIC), file);
+  thread = std::thread(&commit_log_writer_t::run, this);
+}
+
+commit_log_writer_t::~commit_log_writer_t()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    done = true;
+  }
+  work.notify_one();
+  thread.join();
+  fflush(file);
+}
+
+void commit_log_writer_t::submit(uint32_t hart_id, uint32_t vlen, std::vector<uint8_t>& buf)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  space.wait(guard, [&]{ return queued_bytes < MAX_QUEUED_BYTES; });
+
+  queued_bytes += buf.size();
+  queue.push_back({hart_id, vlen, std::move(buf)});
+  buf.clear();
+  if (!spare.empty()) {
+    buf.swap(spare.back());
+    spare.pop_back();
+  }
+  guard.unlock();
+  work.notify_one();
+}
+
+void commit_log_writer_t::run()
+{
+  std::vector<uint8_t> header;
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    work.wait(guard, [&]{ return done || !queue.empty(); });
+    if (queue.empty())
+      break;
+
+    chunk_t chunk = std::move(queue.front());
+    queue.pop_front();
+    guard.unlock();
+
+    header.clear();
+    commit_log_put(header, chunk.hart_id);
+    commit_log_put(header, chunk.vlen);
+    commit_log_put(header, chunk.data.size());
+    fwrite(header.data(), 1, header.size(), file);
+    fwrite(chunk.data.data(), 1, chunk.data.size(), file);
+
+    guard.lock();
+    queued_bytes -= chunk.data.size();
+    chunk.data.clear();
+    spare.push_back(std::move(chunk.data));
+    space.notify_all();
+  }
+}
@@ -0,0 +1,92 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_COMMIT_LOG_WRITER_H
+#define _RISCV_COMMIT_LOG_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Binary commit log, written with --log-binary and turned back into the
+// text format by spike-commit-log.  All integers are LEB128 varints unless
+// noted otherwise.
+//
+//   file:    COMMIT_LOG_MAGIC chunk*
+//   chunk:   hart_id vlen payload_bytes record*
+//   record:  flags(u8) [xlen flen] pc_delta insn_length insn_bits
+//            [vsew fractional_lmul(u8) lmul vl]
+//            nregs { key value }  nloads { addr }  nstores { addr value size(u8) }
+//
+// Each chunk holds consecutive records of one hart and can be decoded on its
+// own.  flags holds the privilege level in its low bits;
+// COMMIT_LOG_HAS_XLEN marks a record that carries xlen and flen (the first
+// in a chunk, and wherever they change), and COMMIT_LOG_HAS_VCONFIG one that
+// carries the vector configuration.  pc_delta is the zigzag-encoded
+// difference between the pc and the fall-through pc of the previous record
+// (0 at the start of a chunk).  Register keys are those of
+// state_t::log_reg_write; x and CSR values are one varint, f values two
+// (low, high), v values vlen/8 raw bytes, and vector-state keys have none.
+#define COMMIT_LOG_MAGIC "SPIKECL1"
+
+enum {
+  COMMIT_LOG_PRIV_MASK = 0x3,
+  COMMIT_LOG_HAS_XLEN = 0x4,
+  COMMIT_LOG_HAS_VCONFIG = 0x8,
+};
+
+inline void commit_log_put(std::vector<uint8_t>& buf, uint64_t x)
+{
+  while (x >= 0x80) {
+    buf.push_back(uint8_t(x) | 0x80);
+    x >>= 7;
+  }
+  buf.push_back(uint8_t(x));
+}
+
+inline void commit_log_put_signed(std::vector<uint8_t>& buf, int64_t x)
+{
+  commit_log_put(buf, (uint64_t(x) << 1) ^ uint64_t(x >> 63));
+}
+
+// Hands chunks of encoded records to a background thread that writes them
+// out, so the simulation thread never blocks on the file unless the writer
+// falls far behind.
+class commit_log_writer_t
+{
+ public:
+  commit_log_writer_t(FILE* file);
+  // writes out everything submitted so far
+  ~commit_log_writer_t();
+
+  // queues the records in buf as one chunk; buf is left empty (and may have
+  // been swapped for a recycled buffer)
+  void submit(uint32_t hart_id, uint32_t vlen, std::vector<uint8_t>& buf);
+
+ private:
+  struct chunk_t {
+    uint32_t hart_id;
+    uint32_t vlen;
+    std::vector<uint8_t> data;
+  };
+
+  // submit() waits while more than this many bytes are queued
+  static const size_t MAX_QUEUED_BYTES = 64 << 20;
+
+  void run();
+
+  FILE* file;
+  std::mutex lock;
+  std::condition_variable work;
+  std::condition_variable space;
+  std::deque<chunk_t> queue;
+  std::vector<std::vector<uint8_t>> spare;
+  size_t queued_bytes;
+  bool done;
+  std::thread thread;
+};
+
+#endif
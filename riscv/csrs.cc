@@ -129,6 +129,8 @@ bool pmpaddr_csr_t::unlogged_write(const reg_t val) noexcept {
   else
     return false;
   proc->get_mmu()->flush_tlb();
+  proc->get_mmu()->flush_pwc();
+  proc->get_mmu()->flush_pmp_cache();
   return true;
 }
 
@@ -277,6 +279,8 @@ bool pmpcfg_csr_t::unlogged_write(const reg_t val) noexcept {
     }
   }
   proc->get_mmu()->flush_tlb();
+  proc->get_mmu()->flush_pwc();
+  proc->get_mmu()->flush_pmp_cache();
   return write_success;
 }
 
@@ -317,6 +321,8 @@ bool mseccfg_csr_t::unlogged_write(const reg_t val) noexcept {
   new_val |= (val & MSECCFG_MML);   //MML is sticky
 
   proc->get_mmu()->flush_tlb();
+  proc->get_mmu()->flush_pwc();
+  proc->get_mmu()->flush_pmp_cache();
 
   return basic_csr_t::unlogged_write(new_val);
 }
@@ -443,7 +449,7 @@ reg_t base_status_csr_t::adjust_sd(const reg_t val) const noexcept {
 
 void base_status_csr_t::maybe_flush_tlb(const reg_t newval) noexcept {
   if ((newval ^ read()) &
-      (MSTATUS_MPP | MSTATUS_MPRV
+      (MSTATUS_MPP | MSTATUS_MPRV | MSTATUS_MPV
        | (has_page ? (MSTATUS_MXR | MSTATUS_SUM) : 0)
       ))
     proc->get_mmu()->flush_tlb();
@@ -469,7 +475,8 @@ vsstatus_csr_t::vsstatus_csr_t(processor_t* const proc, const reg_t addr):
 
 bool vsstatus_csr_t::unlogged_write(const reg_t val) noexcept {
   const reg_t newval = (this->val & ~sstatus_write_mask) | (val & sstatus_write_mask);
-  if (state->v) maybe_flush_tlb(newval);
+  // even when V=0, SUM and MXR affect HLV/HSV and MPRV accesses with MPV=1
+  maybe_flush_tlb(newval);
   this->val = adjust_sd(newval);
   return true;
 }
@@ -847,6 +854,19 @@ henvcfg_csr_t::henvcfg_csr_t(processor_t* const proc, const reg_t addr, const re
 }
 
 
+// implement class hstatus_csr_t
+hstatus_csr_t::hstatus_csr_t(processor_t* const proc, const reg_t addr, const reg_t mask, const reg_t init):
+  masked_csr_t(proc, addr, mask, init) {
+}
+
+bool hstatus_csr_t::unlogged_write(const reg_t val) noexcept {
+  // SPVP selects the privilege mode used by HLV/HSV
+  if ((val ^ read()) & HSTATUS_SPVP)
+    proc->get_mmu()->flush_tlb();
+  return masked_csr_t::unlogged_write(val);
+}
+
+
 // implement class base_atp_csr_t and family
 base_atp_csr_t::base_atp_csr_t(processor_t* const proc, const reg_t addr):
   basic_csr_t(proc, addr, 0) {
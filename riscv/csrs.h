@@ -462,6 +462,15 @@ class henvcfg_csr_t final: public masked_csr_t {
 };
 
 
+// hstatus.SPVP changes must flush the TLBs used by HLV/HSV
+class hstatus_csr_t final: public masked_csr_t {
+ public:
+  hstatus_csr_t(processor_t* const proc, const reg_t addr, const reg_t mask, const reg_t init);
+ protected:
+  virtual bool unlogged_write(const reg_t val) noexcept override;
+};
+
+
 // For satp and vsatp
 // These are three classes in order to handle the [V]TVM bits permission checks
 class base_atp_csr_t: public basic_csr_t {
@@ -1,6 +1,8 @@
 #include "devices.h"
 #include "mmu.h"
 #include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 void bus_t::add_device(reg_t addr, abstract_device_t* dev)
 {
@@ -100,8 +102,91 @@ mem_t::mem_t(reg_t size)
 
 mem_t::~mem_t()
 {
-  for (auto& entry : sparse_memory_map)
-    free(entry.second);
+  for (auto& entry : sparse_memory_map) {
+    auto m = file_mappings.upper_bound(entry.second);
+    if (m == file_mappings.begin() || entry.second >= std::prev(m)->first + std::prev(m)->second.len)
+      free(entry.second);
+  }
+
+  for (auto& m : file_mappings)
+    munmap(m.first, m.second.len);
+}
+
+bool mem_t::map_file(reg_t addr, size_t len, int fd, off_t offset)
+{
+  if (addr % PGSIZE || len % PGSIZE || offset % PGSIZE || addr + len < addr || addr + len > sz)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return false;
+
+  char* map = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+  if (map == MAP_FAILED)
+    return false;
+
+  bool installed = false;
+  for (reg_t pos = 0; pos < len; pos += PGSIZE) {
+    // a page in use may be cached in a hart's TLB, so it must stay put
+    auto search = sparse_memory_map.find((addr + pos) >> PGSHIFT);
+    if (search != sparse_memory_map.end()) {
+      memcpy(search->second, map + pos, PGSIZE);
+    } else {
+      sparse_memory_map[(addr + pos) >> PGSHIFT] = map + pos;
+      installed = true;
+    }
+  }
+
+  // pages are never taken out of the memory map again, so a mapping is
+  // only kept while it backs at least one of them
+  if (installed)
+    file_mappings[map] = {len, true, st.st_dev, st.st_ino};
+  else
+    munmap(map, len);
+  return true;
+}
+
+bool mem_t::maps_file(dev_t dev, ino_t ino)
+{
+  for (auto& m : file_mappings)
+    if (m.second.from_file && m.second.dev == dev && m.second.ino == ino)
+      return true;
+  return false;
+}
+
+bool mem_t::detach_file(dev_t dev, ino_t ino)
+{
+  for (auto& m : file_mappings) {
+    if (!m.second.from_file || m.second.dev != dev || m.second.ino != ino)
+      continue;
+
+    // the copy is moved over the file mapping, so the pages keep their
+    // host addresses
+    size_t len = m.second.len;
+    void* copy = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == MAP_FAILED)
+      return false;
+    memcpy(copy, m.first, len);
+    if (mremap(copy, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, m.first) == MAP_FAILED) {
+      munmap(copy, len);
+      return false;
+    }
+    m.second.from_file = false;
+  }
+  return true;
+}
+
+void mem_t::clear(reg_t addr, size_t len)
+{
+  while (len > 0) {
+    auto n = std::min(PGSIZE - (addr % PGSIZE), reg_t(len));
+    auto search = sparse_memory_map.find(addr >> PGSHIFT);
+    if (search != sparse_memory_map.end())
+      memset(search->second + addr % PGSIZE, 0, n);
+
+    addr += n;
+    len -= n;
+  }
 }
 
 bool mem_t::load_store(reg_t addr, size_t len, uint8_t* bytes, bool store)
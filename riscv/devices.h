@@ -6,8 +6,12 @@
 #include "abstract_device.h"
 #include "platform.h"
 #include <map>
+#include <string>
 #include <vector>
+#include <queue>
 #include <utility>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 class processor_t;
 
@@ -44,10 +48,34 @@ class mem_t : public abstract_device_t {
   char* contents(reg_t addr);
   reg_t size() { return sz; }
 
+  // Backs the pages of [addr, addr + len) that have not been touched yet
+  // with a private mapping of the file fd at offset, so they are read from
+  // the page cache on demand and only copied when written; pages already
+  // in use get a copy of the file contents instead.  addr, len and offset
+  // must be page-aligned.  Returns false if the file cannot be mapped.
+  bool map_file(reg_t addr, size_t len, int fd, off_t offset);
+  // whether some pages are still mapped from the file dev:ino
+  bool maps_file(dev_t dev, ino_t ino);
+  // Gives the pages mapped from the file dev:ino a copy of their contents,
+  // so that later changes to the file (in particular truncating it, which
+  // would make the untouched pages fault) no longer show through.
+  // Returns false if the memory for the copy cannot be had.
+  bool detach_file(dev_t dev, ino_t ino);
+  // zeroes [addr, addr + len), skipping pages that were never touched
+  void clear(reg_t addr, size_t len);
+
  private:
   bool load_store(reg_t addr, size_t len, uint8_t* bytes, bool store);
 
   std::map<reg_t, char*> sparse_memory_map;
+  struct file_mapping_t {
+    size_t len;
+    bool from_file; // false once detach_file has copied it
+    dev_t dev;
+    ino_t ino;
+  };
+  // keyed by the host address each mapping starts at
+  std::map<char*, file_mapping_t> file_mappings;
   reg_t sz;
 };
 
@@ -71,6 +99,112 @@ class clint_t : public abstract_device_t {
   std::vector<mtimecmp_t> mtimecmp;
 };
 
+class plic_t : public abstract_device_t {
+ public:
+  plic_t(std::vector<processor_t*>&, uint32_t ndev);
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  size_t size() { return PLIC_SIZE; }
+  // drives the level-triggered interrupt source id (1 to ndev)
+  void set_interrupt_level(uint32_t id, bool level);
+ private:
+  struct context_t {
+    uint32_t enable = 0;
+    uint32_t threshold = 0;
+  };
+  std::vector<processor_t*>& procs;
+  uint32_t ndev;
+  std::vector<uint32_t> priority;
+  // one bit per source
+  uint32_t level;
+  uint32_t pending;
+  uint32_t claimed;
+  std::vector<context_t> contexts;
+
+  uint32_t sources_mask() { return uint32_t((uint64_t(1) << (ndev + 1)) - 2); }
+  uint32_t best_source(size_t ctx);
+  uint32_t claim(size_t ctx);
+  void complete(size_t ctx, uint32_t id);
+  void update();
+};
+
+// An ns16550a UART on the host terminal.  Output goes through the
+// terminal's buffer, which is flushed a line at a time and periodically
+// from tick(); input is polled from tick() into the receive FIFO.
+class ns16550_t : public abstract_device_t {
+ public:
+  ns16550_t(plic_t* plic, uint32_t interrupt_id);
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  size_t size() { return NS16550_SIZE; }
+  void tick();
+ private:
+  static const size_t FIFO_SIZE = 16;
+  static const unsigned POLL_INTERVAL = 64;
+  plic_t* plic;
+  uint32_t interrupt_id;
+  uint8_t dll;
+  uint8_t dlm;
+  uint8_t ier;
+  uint8_t fcr;
+  uint8_t lcr;
+  uint8_t mcr;
+  uint8_t scr;
+  bool thr_empty_pending;
+  bool interrupt_level;
+  unsigned ticks;
+  std::queue<uint8_t> rx_fifo;
+
+  uint8_t interrupt_identification();
+  void update_interrupt();
+};
+
+class simif_t;
+
+// A virtio-mmio block device backed by a raw image file, which is read and
+// written in place with preadv/pwritev on the guest's buffers.  Requests
+// complete synchronously when the driver notifies the device.
+class virtio_blk_t : public abstract_device_t {
+ public:
+  virtio_blk_t(simif_t* sim, plic_t* plic, uint32_t interrupt_id, const std::string& image);
+  ~virtio_blk_t();
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  size_t size() { return VIRTIO_MMIO_SIZE; }
+ private:
+  simif_t* sim;
+  plic_t* plic;
+  uint32_t interrupt_id;
+  int fd;
+  bool read_only;
+  uint64_t capacity; // in 512-byte sectors
+
+  uint32_t device_features_sel;
+  uint32_t driver_features_sel;
+  uint64_t driver_features;
+  uint32_t status;
+  uint32_t interrupt_status;
+  // the only queue
+  uint32_t queue_sel;
+  uint32_t queue_num;
+  bool queue_ready;
+  uint64_t desc_addr;
+  uint64_t avail_addr;
+  uint64_t used_addr;
+  uint16_t last_avail_idx;
+  std::vector<struct iovec> iov;
+
+  static void set_low(uint64_t& reg, uint32_t val) { reg = (reg >> 32 << 32) | val; }
+  static void set_high(uint64_t& reg, uint32_t val) { reg = (reg & UINT32_MAX) | (uint64_t(val) << 32); }
+  uint64_t device_features();
+  void reset();
+  bool guest_copy(reg_t paddr, void* buf, size_t len, bool to_guest);
+  bool guest_iov(reg_t paddr, size_t len, std::vector<struct iovec>& iov);
+  void process_queue();
+  uint32_t handle_request(uint16_t head);
+  bool transfer(off_t offset, size_t len, bool write);
+};
+
 class mmio_plugin_device_t : public abstract_device_t {
  public:
   mmio_plugin_device_t(const std::string& name, const std::string& args);
@@ -4,185 +4,323 @@
 #include "libfdt.h"
 #include "platform.h"
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
-#include <signal.h>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <sys/types.h>
 
-std::string make_dts(size_t insns_per_rtc_tick, size_t cpu_hz,
+// Sequential-write builder for a flattened device tree.  The buffer is
+// grown whenever libfdt runs out of room.
+class fdt_writer_t
+{
+ public:
+  fdt_writer_t() : buf(4096)
+  {
+    check(fdt_create(buf.data(), buf.size()));
+    check(fdt_finish_reservemap(buf.data()));
+  }
+
+  void begin_node(const std::string& name)
+  {
+    write([&]{ return fdt_begin_node(buf.data(), name.c_str()); });
+  }
+
+  void end_node()
+  {
+    write([&]{ return fdt_end_node(buf.data()); });
+  }
+
+  void property(const char* name, const void* val = NULL, size_t len = 0)
+  {
+    write([&]{ return fdt_property(buf.data(), name, val, len); });
+  }
+
+  void property_string(const char* name, const std::string& str)
+  {
+    property(name, str.c_str(), str.size() + 1);
+  }
+
+  void property_strings(const char* name, const std::vector<std::string>& strs)
+  {
+    std::string list;
+    for (auto& str : strs)
+      list.append(str.c_str(), str.size() + 1);
+    property(name, list.data(), list.size());
+  }
+
+  void property_cells(const char* name, const std::vector<uint32_t>& cells)
+  {
+    std::vector<fdt32_t> val;
+    for (auto cell : cells)
+      val.push_back(cpu_to_fdt32(cell));
+    property(name, val.data(), val.size() * sizeof(fdt32_t));
+  }
+
+  void property_u32(const char* name, uint32_t val)
+  {
+    property_cells(name, {val});
+  }
+
+  // a reg property in two address and two size cells
+  void property_reg(reg_t base, reg_t size)
+  {
+    property_cells("reg", {uint32_t(base >> 32), uint32_t(base), uint32_t(size >> 32), uint32_t(size)});
+  }
+
+  std::string finish()
+  {
+    write([&]{ return fdt_finish(buf.data()); });
+    return std::string(buf.data(), fdt_totalsize(buf.data()));
+  }
+
+ private:
+  std::vector<char> buf;
+
+  template<typename F> void write(F op)
+  {
+    int rc;
+    while ((rc = op()) == -FDT_ERR_NOSPACE) {
+      std::vector<char> bigger(buf.size() * 2);
+      check(fdt_resize(buf.data(), bigger.data(), bigger.size()));
+      buf.swap(bigger);
+    }
+    check(rc);
+  }
+
+  static void check(int rc)
+  {
+    if (rc < 0) {
+      std::cerr << "Failed to build dtb: " << fdt_strerror(rc) << std::endl;
+      exit(1);
+    }
+  }
+};
+
+static std::string node_name(const char* name, reg_t addr)
+{
+  std::stringstream s;
+  s << name << '@' << std::hex << addr;
+  return s.str();
+}
+
+std::string make_dtb(size_t insns_per_rtc_tick, size_t cpu_hz,
                      reg_t initrd_start, reg_t initrd_end,
                      const char* bootargs,
                      std::vector<processor_t*> procs,
-                     std::vector<std::pair<reg_t, mem_t*>> mems)
+                     std::vector<std::pair<reg_t, mem_t*>> mems,
+                     bool virtio_blk, bool uart)
 {
-  std::stringstream s;
-  s << std::dec <<
-         "/dts-v1/;\n"
-         "\n"
-         "/ {\n"
-         "  #address-cells = <2>;\n"
-         "  #size-cells = <2>;\n"
-         "  compatible = \"ucbbar,spike-bare-dev\";\n"
-         "  model = \"ucbbar,spike-bare\";\n"
-         "  chosen {\n";
+  // phandles: hart i's interrupt controller is i + 1, the PLIC follows
+  uint32_t plic_phandle = procs.size() + 1;
+  // the PLIC is only needed by devices that interrupt
+  bool plic = virtio_blk || uart;
+
+  fdt_writer_t w;
+  w.begin_node("");
+  w.property_u32("#address-cells", 2);
+  w.property_u32("#size-cells", 2);
+  w.property_string("compatible", "ucbbar,spike-bare-dev");
+  w.property_string("model", "ucbbar,spike-bare");
+
+  w.begin_node("chosen");
+  if (uart)
+    w.property_string("stdout-path", "/soc/" + node_name("serial", NS16550_BASE));
   if (initrd_start < initrd_end) {
-    s << "    linux,initrd-start = <" << (size_t)initrd_start << ">;\n"
-         "    linux,initrd-end = <" << (size_t)initrd_end << ">;\n";
+    // one cell each, unless the initrd lies above 4 GiB
+    if (initrd_end >> 32) {
+      w.property_cells("linux,initrd-start", {uint32_t(initrd_start >> 32), uint32_t(initrd_start)});
+      w.property_cells("linux,initrd-end", {uint32_t(initrd_end >> 32), uint32_t(initrd_end)});
+    } else {
+      w.property_u32("linux,initrd-start", initrd_start);
+      w.property_u32("linux,initrd-end", initrd_end);
+    }
     if (!bootargs)
-      bootargs = "root=/dev/ram console=hvc0 earlycon=sbi";
+      bootargs = uart ? "root=/dev/ram console=ttyS0 earlycon" : "root=/dev/ram console=hvc0 earlycon=sbi";
   } else {
     if (!bootargs)
-      bootargs = "console=hvc0 earlycon=sbi";
-  }
-    s << "    bootargs = \"";
-  for (size_t i = 0; i < strlen(bootargs); i++) {
-    if (bootargs[i] == '"')
-    s << '\\' << bootargs[i];
-    else
-    s << bootargs[i];
+      bootargs = uart ? "console=ttyS0 earlycon" : "console=hvc0 earlycon=sbi";
   }
-    s << "\";\n";
-    s << "  };\n"
-         "  cpus {\n"
-         "    #address-cells = <1>;\n"
-         "    #size-cells = <0>;\n"
-         "    timebase-frequency = <" << (cpu_hz/insns_per_rtc_tick) << ">;\n";
+  w.property_string("bootargs", bootargs);
+  w.end_node();
+
+  w.begin_node("cpus");
+  w.property_u32("#address-cells", 1);
+  w.property_u32("#size-cells", 0);
+  w.property_u32("timebase-frequency", cpu_hz / insns_per_rtc_tick);
   for (size_t i = 0; i < procs.size(); i++) {
-    s << "    CPU" << i << ": cpu@" << i << " {\n"
-         "      device_type = \"cpu\";\n"
-         "      reg = <" << i << ">;\n"
-         "      status = \"okay\";\n"
-         "      compatible = \"riscv\";\n"
-         "      riscv,isa = \"" << procs[i]->get_isa().get_isa_string() << "\";\n"
-         "      mmu-type = \"riscv," << (procs[i]->get_isa().get_max_xlen() <= 32 ? "sv32" : "sv57") << "\";\n"
-         "      riscv,pmpregions = <16>;\n"
-         "      riscv,pmpgranularity = <4>;\n"
-         "      clock-frequency = <" << cpu_hz << ">;\n"
-         "      CPU" << i << "_intc: interrupt-controller {\n"
-         "        #address-cells = <2>;\n"
-         "        #interrupt-cells = <1>;\n"
-         "        interrupt-controller;\n"
-         "        compatible = \"riscv,cpu-intc\";\n"
-         "      };\n"
-         "    };\n";
+    w.begin_node("cpu@" + std::to_string(i));
+    w.property_string("device_type", "cpu");
+    w.property_u32("reg", i);
+    w.property_string("status", "okay");
+    w.property_string("compatible", "riscv");
+    w.property_string("riscv,isa", procs[i]->get_isa().get_isa_string());
+    w.property_string("mmu-type", procs[i]->get_isa().get_max_xlen() <= 32 ? "riscv,sv32" : "riscv,sv57");
+    w.property_u32("riscv,pmpregions", 16);
+    w.property_u32("riscv,pmpgranularity", 4);
+    w.property_u32("clock-frequency", cpu_hz);
+    w.begin_node("interrupt-controller");
+    w.property_u32("#address-cells", 2);
+    w.property_u32("#interrupt-cells", 1);
+    w.property("interrupt-controller");
+    w.property_string("compatible", "riscv,cpu-intc");
+    w.property_u32("phandle", i + 1);
+    w.end_node();
+    w.end_node();
   }
-  s <<   "  };\n";
+  w.end_node();
+
   for (auto& m : mems) {
-    s << std::hex <<
-         "  memory@" << m.first << " {\n"
-         "    device_type = \"memory\";\n"
-         "    reg = <0x" << (m.first >> 32) << " 0x" << (m.first & (uint32_t)-1) <<
-                   " 0x" << (m.second->size() >> 16 >> 16) << " 0x" << (m.second->size() & (uint32_t)-1) << ">;\n"
-         "  };\n";
+    w.begin_node(node_name("memory", m.first));
+    w.property_string("device_type", "memory");
+    w.property_reg(m.first, m.second->size());
+    w.end_node();
   }
-  s <<   "  soc {\n"
-         "    #address-cells = <2>;\n"
-         "    #size-cells = <2>;\n"
-         "    compatible = \"ucbbar,spike-bare-soc\", \"simple-bus\";\n"
-         "    ranges;\n"
-         "    clint@" << CLINT_BASE << " {\n"
-         "      compatible = \"riscv,clint0\";\n"
-         "      interrupts-extended = <" << std::dec;
-  for (size_t i = 0; i < procs.size(); i++)
-    s << "&CPU" << i << "_intc 3 &CPU" << i << "_intc 7 ";
-  reg_t clintbs = CLINT_BASE;
-  reg_t clintsz = CLINT_SIZE;
-  s << std::hex << ">;\n"
-         "      reg = <0x" << (clintbs >> 32) << " 0x" << (clintbs & (uint32_t)-1) <<
-                     " 0x" << (clintsz >> 32) << " 0x" << (clintsz & (uint32_t)-1) << ">;\n"
-         "    };\n"
-         "  };\n"
-         "  htif {\n"
-         "    compatible = \"ucb,htif0\";\n"
-         "  };\n"
-         "};\n";
-  return s.str();
-}
 
-std::string dts_compile(const std::string& dts)
-{
-  // Convert the DTS to DTB
-  int dts_pipe[2];
-  pid_t dts_pid;
-
-  fflush(NULL); // flush stdout/stderr before forking
-  if (pipe(dts_pipe) != 0 || (dts_pid = fork()) < 0) {
-    std::cerr << "Failed to fork dts child: " << strerror(errno) << std::endl;
-    exit(1);
-  }
+  w.begin_node("soc");
+  w.property_u32("#address-cells", 2);
+  w.property_u32("#size-cells", 2);
+  w.property_strings("compatible", {"ucbbar,spike-bare-soc", "simple-bus"});
+  w.property("ranges");
 
-  // Child process to output dts
-  if (dts_pid == 0) {
-    close(dts_pipe[0]);
-    int step, len = dts.length();
-    const char *buf = dts.c_str();
-    for (int done = 0; done < len; done += step) {
-      step = write(dts_pipe[1], buf+done, len-done);
-      if (step == -1) {
-        std::cerr << "Failed to write dts: " << strerror(errno) << std::endl;
-        exit(1);
-      }
-    }
-    close(dts_pipe[1]);
-    exit(0);
+  std::vector<uint32_t> clint_irqs;
+  for (size_t i = 0; i < procs.size(); i++)
+    clint_irqs.insert(clint_irqs.end(), {uint32_t(i + 1), 3, uint32_t(i + 1), 7});
+  w.begin_node(node_name("clint", CLINT_BASE));
+  w.property_string("compatible", "riscv,clint0");
+  w.property_cells("interrupts-extended", clint_irqs);
+  w.property_reg(CLINT_BASE, CLINT_SIZE);
+  w.end_node();
+
+  if (plic) {
+    std::vector<uint32_t> plic_irqs;
+    for (size_t i = 0; i < procs.size(); i++)
+      plic_irqs.insert(plic_irqs.end(), {uint32_t(i + 1), 11, uint32_t(i + 1), 9});
+    w.begin_node(node_name("interrupt-controller", PLIC_BASE));
+    w.property_string("compatible", "riscv,plic0");
+    w.property_u32("#address-cells", 0);
+    w.property_u32("#interrupt-cells", 1);
+    w.property("interrupt-controller");
+    w.property_cells("interrupts-extended", plic_irqs);
+    w.property_reg(PLIC_BASE, PLIC_SIZE);
+    w.property_u32("riscv,ndev", PLIC_NDEV);
+    w.property_u32("riscv,max-priority", 7);
+    w.property_u32("phandle", plic_phandle);
+    w.end_node();
   }
 
-  pid_t dtb_pid;
-  int dtb_pipe[2];
-  if (pipe(dtb_pipe) != 0 || (dtb_pid = fork()) < 0) {
-    std::cerr << "Failed to fork dtb child: " << strerror(errno) << std::endl;
-    exit(1);
+  if (virtio_blk) {
+    w.begin_node(node_name("virtio", VIRTIO_BLK_BASE));
+    w.property_string("compatible", "virtio,mmio");
+    w.property_reg(VIRTIO_BLK_BASE, VIRTIO_MMIO_SIZE);
+    w.property_u32("interrupt-parent", plic_phandle);
+    w.property_u32("interrupts", VIRTIO_BLK_IRQ);
+    w.end_node();
   }
 
-  // Child process to output dtb
-  if (dtb_pid == 0) {
-    dup2(dts_pipe[0], 0);
-    dup2(dtb_pipe[1], 1);
-    close(dts_pipe[0]);
-    close(dts_pipe[1]);
-    close(dtb_pipe[0]);
-    close(dtb_pipe[1]);
-    execlp(DTC, DTC, "-O", "dtb", 0);
-    std::cerr << "Failed to run " DTC ": " << strerror(errno) << std::endl;
-    exit(1);
+  if (uart) {
+    w.begin_node(node_name("serial", NS16550_BASE));
+    w.property_string("compatible", "ns16550a");
+    w.property_reg(NS16550_BASE, NS16550_SIZE);
+    w.property_u32("clock-frequency", NS16550_CLOCK_HZ);
+    w.property_u32("reg-shift", 0);
+    w.property_u32("reg-io-width", 1);
+    w.property_u32("interrupt-parent", plic_phandle);
+    w.property_u32("interrupts", NS16550_IRQ);
+    w.end_node();
   }
+  w.end_node();
 
-  close(dts_pipe[1]);
-  close(dts_pipe[0]);
-  close(dtb_pipe[1]);
+  w.begin_node("htif");
+  w.property_string("compatible", "ucb,htif0");
+  w.end_node();
 
-  // Read-out dtb
-  std::stringstream dtb;
+  w.end_node();
+  return w.finish();
+}
 
-  int got;
-  char buf[4096];
-  while ((got = read(dtb_pipe[0], buf, sizeof(buf))) > 0) {
-    dtb.write(buf, got);
-  }
-  if (got == -1) {
-    std::cerr << "Failed to read dtb: " << strerror(errno) << std::endl;
-    exit(1);
+// A property is shown as strings if it is a list of non-empty, printable,
+// NUL-terminated strings, else as cells if it is a whole number of them.
+static bool is_string_list(const char* val, int len)
+{
+  if (len == 0 || val[0] == '\0' || val[len - 1] != '\0')
+    return false;
+  for (int i = 0; i < len; i++) {
+    if (val[i] == '\0' ? val[i - 1] == '\0' : !isprint((unsigned char)val[i]))
+      return false;
   }
-  close(dtb_pipe[0]);
-
-  // Reap children
-  int status;
-  waitpid(dts_pid, &status, 0);
-  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-    std::cerr << "Child dts process failed" << std::endl;
-    exit(1);
+  return true;
+}
+
+static void dump_property(const char* val, int len, std::ostream& s)
+{
+  if (len == 0)
+    return;
+
+  s << " = ";
+  if (is_string_list(val, len)) {
+    for (int i = 0; i < len; i++) {
+      if (i == 0 || val[i - 1] == '\0')
+        s << (i ? ", \"" : "\"");
+      if (val[i] == '\0')
+        s << '"';
+      else if (val[i] == '"' || val[i] == '\\')
+        s << '\\' << val[i];
+      else
+        s << val[i];
+    }
+  } else if (len % sizeof(fdt32_t) == 0) {
+    s << '<' << std::hex;
+    for (int i = 0; i < len; i += sizeof(fdt32_t)) {
+      fdt32_t cell;
+      memcpy(&cell, val + i, sizeof(cell));
+      s << (i ? " 0x" : "0x") << fdt32_to_cpu(cell);
+    }
+    s << std::dec << '>';
+  } else {
+    s << '[' << std::hex << std::setfill('0');
+    for (int i = 0; i < len; i++)
+      s << (i ? " " : "") << std::setw(2) << (unsigned)(unsigned char)val[i];
+    s << std::dec << std::setfill(' ') << ']';
   }
-  waitpid(dtb_pid, &status, 0);
-  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-    std::cerr << "Child dtb process failed" << std::endl;
-    exit(1);
+}
+
+static void dump_node(const void* fdt, int node, int depth, std::ostream& s)
+{
+  std::string indent(2 * depth, ' ');
+  s << indent << (depth ? fdt_get_name(fdt, node, NULL) : "/") << " {\n";
+
+  int prop;
+  fdt_for_each_property_offset(prop, fdt, node) {
+    const char* name;
+    int len;
+    const char* val = (const char*)fdt_getprop_by_offset(fdt, prop, &name, &len);
+    s << indent << "  " << name;
+    dump_property(val, len, s);
+    s << ";\n";
   }
 
-  return dtb.str();
+  int child;
+  fdt_for_each_subnode(child, fdt, node)
+    dump_node(fdt, child, depth + 1, s);
+
+  s << indent << "};\n";
 }
 
+std::string dtb_to_dts(const std::string& dtb)
+{
+  const void* fdt = dtb.c_str();
+  std::stringstream s;
+  s << "/dts-v1/;\n\n";
+  for (int i = 0; i < fdt_num_mem_rsv(fdt); i++) {
+    uint64_t addr, size;
+    fdt_get_mem_rsv(fdt, i, &addr, &size);
+    s << std::hex << "/memreserve/ 0x" << addr << " 0x" << size << ";\n" << std::dec;
+  }
+  dump_node(fdt, 0, 0, s);
+  return s.str();
+}
 
 static int fdt_get_node_addr_size(void *fdt, int node, reg_t *addr,
                                   unsigned long *size, const char *field)
@@ -277,6 +415,50 @@ int fdt_parse_clint(void *fdt, reg_t *clint_addr,
   return 0;
 }
 
+int fdt_parse_plic(void *fdt, reg_t *plic_addr, uint32_t *ndev,
+                   const char *compatible)
+{
+  int nodeoffset, len, rc;
+  const fdt32_t *ndev_p;
+
+  nodeoffset = fdt_node_offset_by_compatible(fdt, -1, compatible);
+  if (nodeoffset < 0)
+    return nodeoffset;
+
+  rc = fdt_get_node_addr_size(fdt, nodeoffset, plic_addr, NULL, "reg");
+  if (rc < 0 || !plic_addr)
+    return -ENODEV;
+
+  ndev_p = (fdt32_t *)fdt_getprop(fdt, nodeoffset, "riscv,ndev", &len);
+  if (!ndev || !ndev_p)
+    return -ENODEV;
+  *ndev = fdt32_to_cpu(*ndev_p);
+
+  return 0;
+}
+
+int fdt_parse_ns16550(void *fdt, reg_t *ns16550_addr, uint32_t *interrupt_id,
+                      const char *compatible)
+{
+  int nodeoffset, len, rc;
+  const fdt32_t *id_p;
+
+  nodeoffset = fdt_node_offset_by_compatible(fdt, -1, compatible);
+  if (nodeoffset < 0)
+    return nodeoffset;
+
+  rc = fdt_get_node_addr_size(fdt, nodeoffset, ns16550_addr, NULL, "reg");
+  if (rc < 0 || !ns16550_addr)
+    return -ENODEV;
+
+  // a UART without an interrupt is left to be polled
+  id_p = (fdt32_t *)fdt_getprop(fdt, nodeoffset, "interrupts", &len);
+  if (interrupt_id)
+    *interrupt_id = id_p ? fdt32_to_cpu(*id_p) : 0;
+
+  return 0;
+}
+
 int fdt_parse_pmp_num(void *fdt, int cpu_offset, reg_t *pmp_num)
 {
   int rc;
@@ -7,13 +7,16 @@
 #include "mmu.h"
 #include <string>
 
-std::string make_dts(size_t insns_per_rtc_tick, size_t cpu_hz,
+// Builds the default platform's device tree blob directly with libfdt.
+std::string make_dtb(size_t insns_per_rtc_tick, size_t cpu_hz,
                      reg_t initrd_start, reg_t initrd_end,
                      const char* bootargs,
                      std::vector<processor_t*> procs,
-                     std::vector<std::pair<reg_t, mem_t*>> mems);
+                     std::vector<std::pair<reg_t, mem_t*>> mems,
+                     bool virtio_blk, bool uart);
 
-std::string dts_compile(const std::string& dts);
+// Renders a device tree blob as source, for --dump-dts.
+std::string dtb_to_dts(const std::string& dtb);
 
 int fdt_get_offset(void *fdt, const char *field);
 int fdt_get_first_subnode(void *fdt, int node);
@@ -21,6 +24,10 @@ int fdt_get_next_subnode(void *fdt, int node);
 
 int fdt_parse_clint(void *fdt, reg_t *clint_addr,
                     const char *compatible);
+int fdt_parse_plic(void *fdt, reg_t *plic_addr, uint32_t *ndev,
+                   const char *compatible);
+int fdt_parse_ns16550(void *fdt, reg_t *ns16550_addr, uint32_t *interrupt_id,
+                      const char *compatible);
 int fdt_parse_pmp_num(void *fdt, int cpu_offset, reg_t *pmp_num);
 int fdt_parse_pmp_alignment(void *fdt, int cpu_offset, reg_t *pmp_align);
 int fdt_parse_mmu_type(void *fdt, int cpu_offset, const char **mmu_type);
@@ -3,6 +3,7 @@
 #include "processor.h"
 #include "mmu.h"
 #include "disasm.h"
+#include "commit_log_writer.h"
 #include <cassert>
 
 #ifdef RISCV_ENABLE_COMMITLOG
@@ -64,8 +65,99 @@ const char* processor_t::get_symbol(uint64_t addr)
   return sim->get_symbol(addr);
 }
 
+// hand the binary records over once this much has accumulated, even in the
+// middle of a step
+static const size_t COMMIT_LOG_CHUNK_BYTES = 1 << 20;
+
+static void commit_log_encode_insn(processor_t *p, reg_t pc, insn_t insn)
+{
+  state_t* state = p->get_state();
+  auto& buf = state->log_buffer;
+  int xlen = state->last_inst_xlen;
+  int flen = state->last_inst_flen;
+  reg_t xmask = xlen == 64 ? reg_t(-1) : (reg_t(1) << xlen) - 1;
+  reg_t fmask = flen >= 64 ? reg_t(-1) : (reg_t(1) << flen) - 1;
+
+  // chunks are decodable on their own, so restart the deltas in each one
+  if (buf.empty())
+    state->log_next_pc = state->log_xlen = state->log_flen = 0;
+
+  bool has_xlen = xlen != state->log_xlen || flen != state->log_flen;
+  bool has_vconfig = false;
+  size_t nregs = 0;
+  for (auto item : state->log_reg_write) {
+    if (item.first == 0)
+      continue;
+    nregs++;
+    has_vconfig |= (item.first & 0xf) == 2 || (item.first & 0xf) == 3;
+  }
+
+  buf.push_back((state->last_inst_priv & COMMIT_LOG_PRIV_MASK) |
+                (has_xlen ? COMMIT_LOG_HAS_XLEN : 0) |
+                (has_vconfig ? COMMIT_LOG_HAS_VCONFIG : 0));
+  if (has_xlen) {
+    commit_log_put(buf, xlen);
+    commit_log_put(buf, flen);
+    state->log_xlen = xlen;
+    state->log_flen = flen;
+  }
+  commit_log_put_signed(buf, pc - state->log_next_pc);
+  commit_log_put(buf, insn.length());
+  commit_log_put(buf, insn.bits());
+  state->log_next_pc = pc + insn.length();
+
+  if (has_vconfig) {
+    commit_log_put(buf, p->VU.vsew);
+    buf.push_back(p->VU.vflmul < 1);
+    commit_log_put(buf, p->VU.vflmul < 1 ? (reg_t)(1 / p->VU.vflmul) : (reg_t)p->VU.vflmul);
+    commit_log_put(buf, p->VU.vl->read());
+  }
+
+  commit_log_put(buf, nregs);
+  for (auto item : state->log_reg_write) {
+    if (item.first == 0)
+      continue;
+
+    commit_log_put(buf, item.first);
+    switch (item.first & 0xf) {
+    case 0:
+    case 4:
+      commit_log_put(buf, item.second.v[0] & xmask);
+      break;
+    case 1:
+      commit_log_put(buf, item.second.v[0] & fmask);
+      commit_log_put(buf, flen > 64 ? item.second.v[1] : 0);
+      break;
+    case 2: {
+      const uint8_t* vreg = &p->VU.elt<uint8_t>(item.first >> 4, 0);
+      buf.insert(buf.end(), vreg, vreg + p->VU.VLEN / 8);
+      break;
+    }
+    }
+  }
+
+  commit_log_put(buf, state->log_mem_read.size());
+  for (auto item : state->log_mem_read)
+    commit_log_put(buf, std::get<0>(item));
+
+  commit_log_put(buf, state->log_mem_write.size());
+  for (auto item : state->log_mem_write) {
+    commit_log_put(buf, std::get<0>(item));
+    commit_log_put(buf, std::get<1>(item));
+    buf.push_back(std::get<2>(item));
+  }
+
+  if (unlikely(buf.size() >= COMMIT_LOG_CHUNK_BYTES))
+    p->get_commit_log_writer()->submit(p->get_id(), p->VU.VLEN, buf);
+}
+
 static void commit_log_print_insn(processor_t *p, reg_t pc, insn_t insn)
 {
+  if (p->get_commit_log_writer()) {
+    commit_log_encode_insn(p, pc, insn);
+    return;
+  }
+
   FILE *log_file = p->get_log_file();
 
   auto& reg = p->get_state()->log_reg_write;
@@ -208,7 +300,6 @@ static inline reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
   } catch(...) {
     throw;
   }
-  p->update_histogram(pc);
 
   return npc;
 }
@@ -276,7 +367,11 @@ void processor_t::step(size_t n)
           insn_fetch_t fetch = mmu->load_insn(pc);
           if (debug && !state.serialized)
             disasm(fetch.insn);
-          pc = execute_insn(this, pc, fetch);
+          reg_t npc = execute_insn(this, pc, fetch);
+          // only instructions that completed without trapping are counted
+          if (npc != PC_SERIALIZE_BEFORE)
+            update_histogram(pc);
+          pc = npc;
           advance_pc();
         }
       }
@@ -285,7 +380,21 @@ void processor_t::step(size_t n)
         // Main simulation loop, fast path.
         for (auto ic_entry = _mmu->access_icache(pc); ; ) {
           auto fetch = ic_entry->data;
+#ifdef RISCV_ENABLE_HISTOGRAM
+          reg_t insn_pc = pc, insn_tag = ic_entry->tag;
+#endif
           pc = execute_insn(this, pc, fetch);
+#ifdef RISCV_ENABLE_HISTOGRAM
+          // only instructions that completed are counted (one that asked
+          // to be serialized runs again); one that flushed the icache, e.g.
+          // fence.i, is counted directly
+          if (likely(pc != PC_SERIALIZE_BEFORE)) {
+            if (likely(ic_entry->tag == insn_tag))
+              ic_entry->count++;
+            else
+              update_histogram(insn_pc);
+          }
+#endif
           ic_entry = ic_entry->next;
           if (unlikely(ic_entry->tag != pc))
             break;
@@ -317,7 +426,10 @@ void processor_t::step(size_t n)
         // instructions are idempotent so restarting is safe.)
 
         insn_fetch_t fetch = mmu->load_insn(pc);
-        pc = execute_insn(this, pc, fetch);
+        reg_t npc = execute_insn(this, pc, fetch);
+        if (npc != PC_SERIALIZE_BEFORE)
+          update_histogram(pc);
+        pc = npc;
         advance_pc();
 
         delete mmu->matched_trigger;
@@ -358,4 +470,13 @@ void processor_t::step(size_t n)
 
     n -= instret;
   }
+
+  mmu->flush_trace();
+
+#ifdef RISCV_ENABLE_COMMITLOG
+  // hand this step's records over, so that harts' records stay interleaved
+  // as in the text log
+  if (commit_log_writer && !state.log_buffer.empty())
+    commit_log_writer->submit(id, VU.VLEN, state.log_buffer);
+#endif
 }
@@ -2,3 +2,4 @@ require_extension('H');
 require_novirt();
 require_privilege(PRV_S);
 MMU.flush_tlb();
+MMU.flush_pwc();
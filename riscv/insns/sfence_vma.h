@@ -7,3 +7,4 @@ if (STATE.v) {
   require_privilege(get_field(STATE.mstatus->read(), MSTATUS_TVM) ? PRV_M : PRV_S);
 }
 MMU.flush_tlb();
+MMU.flush_pwc();
@@ -1,2 +1,2 @@
 // vle8.v and vlseg[2-8]e8.v
-VI_LD(0, (i * nf + fn), int8, false);
+VI_LD_UNIT(int8, false);
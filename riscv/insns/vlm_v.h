@@ -1,2 +1,2 @@
 // vle1.v and vlseg[2-8]e8.v
-VI_LD(0, (i * nf + fn), int8, true);
+VI_LD_UNIT(int8, true);
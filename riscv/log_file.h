@@ -3,13 +3,16 @@
 #define _RISCV_LOGFILE_H
 
 #include <stdio.h>
+#include <string.h>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
+#include "compress.h"
 
 // Header-only class wrapping a log file. When constructed with an
 // actual path, it opens the named file for writing. When constructed
-// with the null path, it wraps stderr.
+// with the null path, it wraps stderr. A path ending in ".z" gets a
+// block-compressed stream (see block_compressor_t; spike-log-cat reads it).
 class log_file_t
 {
 public:
@@ -26,6 +29,15 @@ public:
           << strerror (errno);
       throw std::runtime_error(oss.str());
     }
+
+    size_t len = strlen(path);
+    if (len > 2 && strcmp(path + len - 2, ".z") == 0) {
+      FILE *compressed = block_compressor_t::open(wrapped_file.get());
+      if (!compressed)
+        throw std::runtime_error("Failed to set up log compression");
+      wrapped_file.release();
+      wrapped_file.reset(compressed);
+    }
   }
 
   FILE *get() { return wrapped_file ? wrapped_file.get() : stderr; }
@@ -13,6 +13,14 @@ enum access_type {
   FETCH,
 };
 
+// one access recorded for later delivery to a tracer
+struct memtrace_entry_t
+{
+  uint64_t addr;
+  uint32_t bytes;
+  access_type type;
+};
+
 class memtracer_t
 {
  public:
@@ -22,11 +30,23 @@ class memtracer_t
   virtual bool interested_in_range(uint64_t begin, uint64_t end, access_type type) = 0;
   virtual void trace(uint64_t addr, size_t bytes, access_type type) = 0;
   virtual void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) = 0;
+
+  // true if the tracer shares no state with the other tracers it is hooked
+  // up alongside, so that it can be handed a whole batch at a time
+  virtual bool independent() { return false; }
+
+  // deliver a batch of accesses, oldest first
+  virtual void trace_batch(const memtrace_entry_t* entries, size_t n)
+  {
+    for (size_t i = 0; i < n; i++)
+      trace(entries[i].addr, entries[i].bytes, entries[i].type);
+  }
 };
 
 class memtracer_list_t : public memtracer_t
 {
  public:
+  memtracer_list_t() : all_independent(true) {}
   bool empty() { return list.empty(); }
   bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
   {
@@ -45,12 +65,27 @@ class memtracer_list_t : public memtracer_t
     for (auto it: list)
       it->clean_invalidate(addr, bytes, clean, inval);
   }
+  void trace_batch(const memtrace_entry_t* entries, size_t n)
+  {
+    if (list.size() == 1 || all_independent) {
+      for (auto it: list)
+        it->trace_batch(entries, n);
+      return;
+    }
+
+    // hand each access to every tracer before moving on to the next, since
+    // tracers may share state (e.g. an L2 behind both L1 caches)
+    for (size_t i = 0; i < n; i++)
+      trace(entries[i].addr, entries[i].bytes, entries[i].type);
+  }
   void hook(memtracer_t* h)
   {
     list.push_back(h);
+    all_independent = all_independent && h->independent();
   }
  private:
   std::vector<memtracer_t*> list;
+  bool all_independent;
 };
 
 #endif
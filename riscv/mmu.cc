@@ -4,6 +4,8 @@
 #include "arith.h"
 #include "simif.h"
 #include "processor.h"
+#include <iostream>
+#include <iomanip>
 
 mmu_t::mmu_t(simif_t* sim, processor_t* proc)
  : sim(sim), proc(proc),
@@ -15,7 +17,17 @@ mmu_t::mmu_t(simif_t* sim, processor_t* proc)
   check_triggers_store(false),
   matched_trigger(NULL)
 {
+  walk_count = walk_pte_reads = cur_walk_pte_reads = 0;
+  pwc_lookups = pwc_hits = 0;
+  watched_ppn = -1;
+  trace_buffer_len = 0;
+#ifdef RISCV_ENABLE_HISTOGRAM
+  for (size_t i = 0; i < ICACHE_ENTRIES; i++)
+    icache[i].count = 0;
+#endif
   flush_tlb();
+  flush_pwc();
+  flush_pmp_cache();
   yield_load_reservation();
 }
 
@@ -25,8 +37,12 @@ mmu_t::~mmu_t()
 
 void mmu_t::flush_icache()
 {
-  for (size_t i = 0; i < ICACHE_ENTRIES; i++)
+  for (size_t i = 0; i < ICACHE_ENTRIES; i++) {
+#ifdef RISCV_ENABLE_HISTOGRAM
+    spill_histogram(&icache[i]);
+#endif
     icache[i].tag = -1;
+  }
 }
 
 void mmu_t::flush_tlb()
@@ -34,10 +50,110 @@ void mmu_t::flush_tlb()
   memset(tlb_insn_tag, -1, sizeof(tlb_insn_tag));
   memset(tlb_load_tag, -1, sizeof(tlb_load_tag));
   memset(tlb_store_tag, -1, sizeof(tlb_store_tag));
+  memset(xlate_tlb_load_tag, -1, sizeof(xlate_tlb_load_tag));
+  memset(xlate_tlb_store_tag, -1, sizeof(xlate_tlb_store_tag));
 
   flush_icache();
 }
 
+void mmu_t::flush_pwc()
+{
+  for (size_t i = 0; i < PWC_ENTRIES; i++)
+    pwc[i].level = -1;
+  pwc_pages.clear();
+}
+
+void mmu_t::flush_pmp_cache()
+{
+  for (size_t i = 0; i < PMP_CACHE_ENTRIES; i++)
+    pmp_cache[i].ppn = -1;
+}
+
+static reg_t pwc_prefix(reg_t addr, const vm_info& vm, int level)
+{
+  int va_bits = PGSHIFT + vm.levels * vm.idxbits + vm.widenbits;
+  reg_t va_mask = va_bits >= 64 ? reg_t(-1) : (reg_t(1) << va_bits) - 1;
+  return (addr & va_mask) >> (PGSHIFT + level * vm.idxbits);
+}
+
+static size_t pwc_index(reg_t prefix, int level, reg_t entries)
+{
+  return (prefix ^ (reg_t(level) << 4)) % entries;
+}
+
+int mmu_t::pwc_lookup(bool stage2, bool virt, reg_t root, reg_t gatp, reg_t addr, const vm_info& vm, reg_t* base)
+{
+  pwc_lookups++;
+
+  // look for the deepest cached non-leaf PTE; an entry at level i names the
+  // table that the walk consults at level i-1.
+  for (int i = 1; i < vm.levels; i++) {
+    reg_t prefix = pwc_prefix(addr, vm, i);
+    pwc_entry_t& e = pwc[pwc_index(prefix, i, PWC_ENTRIES)];
+    if (e.level == i && e.prefix == prefix && e.root == root && e.gatp == gatp
+        && e.stage2 == stage2 && e.virt == virt) {
+      pwc_hits++;
+      *base = e.base;
+      return i - 1;
+    }
+  }
+
+  *base = vm.ptbase;
+  return vm.levels - 1;
+}
+
+void mmu_t::pwc_insert(bool stage2, bool virt, reg_t root, reg_t gatp, reg_t addr, const vm_info& vm, int level, reg_t base, reg_t pte_paddr)
+{
+  reg_t prefix = pwc_prefix(addr, vm, level);
+  pwc[pwc_index(prefix, level, PWC_ENTRIES)] = {root, gatp, prefix, base, level, stage2, virt};
+
+  // stores to this page must now be seen by store_slow_path, so evict any
+  // store-TLB entries that map it.
+  reg_t ppn = pte_paddr >> PGSHIFT;
+  if (!pwc_pages.insert(ppn).second)
+    return;
+  for (unsigned t = 0; t <= XLATE_TLBS; t++) {
+    reg_t* tags = t == XLATE_TLBS ? tlb_store_tag : xlate_tlb_store_tag[t];
+    tlb_entry_t* data = t == XLATE_TLBS ? tlb_data : xlate_tlb_data[t];
+    for (size_t i = 0; i < TLB_ENTRIES; i++) {
+      if (tags[i] == reg_t(-1))
+        continue;
+      reg_t vaddr = (tags[i] & ~TLB_FLAGS) << PGSHIFT;
+      if (((data[i].target_offset + vaddr) >> PGSHIFT) == ppn)
+        tags[i] = -1;
+    }
+  }
+}
+
+void mmu_t::watch_store_page(reg_t ppn)
+{
+  watched_ppn = ppn;
+  flush_tlb();
+}
+
+void mmu_t::print_stats()
+{
+  if (walk_count == 0)
+    return;
+
+  float depth = float(walk_pte_reads) / walk_count;
+  float hr = pwc_lookups ? 100.0f * pwc_hits / pwc_lookups : 0.0f;
+
+  std::string name = "MMU" + std::to_string(proc ? proc->get_id() : 0);
+
+  std::cout << std::setprecision(3) << std::fixed;
+  std::cout << name << " ";
+  std::cout << "Page Walks:            " << walk_count << std::endl;
+  std::cout << name << " ";
+  std::cout << "Avg Walk Depth:        " << depth << std::endl;
+  std::cout << name << " ";
+  std::cout << "PWC Lookups:           " << pwc_lookups << std::endl;
+  std::cout << name << " ";
+  std::cout << "PWC Hits:              " << pwc_hits << std::endl;
+  std::cout << name << " ";
+  std::cout << "PWC Hit Rate:          " << hr << '%' << std::endl;
+}
+
 static void throw_access_exception(bool virt, reg_t addr, access_type type)
 {
   switch (type) {
@@ -68,7 +184,12 @@ reg_t mmu_t::translate(reg_t addr, reg_t len, access_type type, uint32_t xlate_f
     }
   }
 
+  cur_walk_pte_reads = 0;
   reg_t paddr = walk(addr, type, mode, virt, hlvx) | (addr & (PGSIZE-1));
+  if (cur_walk_pte_reads) {
+    walk_count++;
+    walk_pte_reads += cur_walk_pte_reads;
+  }
   if (!pmp_ok(paddr, len, type, mode))
     throw_access_exception(virt, addr, type);
   return paddr;
@@ -146,9 +267,8 @@ void mmu_t::load_slow_path(reg_t addr, reg_t len, uint8_t* bytes, uint32_t xlate
   if (auto host_addr = sim->addr_to_mem(paddr)) {
     memcpy(bytes, host_addr, len);
     if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
-      tracer.trace(paddr, len, LOAD);
-    else if (xlate_flags == 0)
-      refill_tlb(addr, paddr, host_addr, LOAD);
+      trace_access(paddr, len, LOAD);
+    refill_tlb(addr, paddr, host_addr, LOAD, xlate_flags);
   } else if (!mmio_load(paddr, len, bytes)) {
     throw trap_load_access_fault((proc) ? proc->state.v : false, addr, 0, 0);
   }
@@ -175,53 +295,117 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_
   if (actually_store) {
     if (auto host_addr = sim->addr_to_mem(paddr)) {
       memcpy(host_addr, bytes, len);
+      if (unlikely(!pwc_pages.empty()) && pwc_pages.count(paddr >> PGSHIFT))
+        flush_pwc();
+      if (unlikely((paddr >> PGSHIFT) == watched_ppn))
+        sim->store_watched(paddr, len);
       if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
-        tracer.trace(paddr, len, STORE);
-      else if (xlate_flags == 0)
-        refill_tlb(addr, paddr, host_addr, STORE);
+        trace_access(paddr, len, STORE);
+      refill_tlb(addr, paddr, host_addr, STORE, xlate_flags);
     } else if (!mmio_store(paddr, len, bytes)) {
       throw trap_store_access_fault((proc) ? proc->state.v : false, addr, 0, 0);
     }
   }
 }
 
-tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type)
+char* mmu_t::bulk_slow_path(reg_t addr, reg_t len, access_type type)
+{
+  // Only the first byte is checked here, so that any fault is reported at
+  // addr.  If the rest of the range might fault, the page doesn't make it
+  // into the TLB and the caller falls back to one access at a time.
+  reg_t paddr = translate(addr, 1, type, 0);
+
+  char* host_addr = sim->addr_to_mem(paddr);
+  if (!host_addr || tracer.interested_in_range(paddr, paddr + PGSIZE, type))
+    return NULL;
+
+  refill_tlb(addr, paddr, host_addr, type);
+  return tlb_host_addr(addr, type, 0);
+}
+
+tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type, uint32_t xlate_flags)
 {
   reg_t idx = (vaddr >> PGSHIFT) % TLB_ENTRIES;
   reg_t expected_tag = vaddr >> PGSHIFT;
 
   tlb_entry_t entry = {host_addr - vaddr, paddr - vaddr};
 
-  if (proc && get_field(proc->state.mstatus->read(), MSTATUS_MPRV))
-    return entry;
-
-  if ((tlb_load_tag[idx] & ~TLB_CHECK_TRIGGERS) != expected_tag)
-    tlb_load_tag[idx] = -1;
-  if ((tlb_store_tag[idx] & ~TLB_CHECK_TRIGGERS) != expected_tag)
-    tlb_store_tag[idx] = -1;
-  if ((tlb_insn_tag[idx] & ~TLB_CHECK_TRIGGERS) != expected_tag)
+  reg_t* load_tag = tlb_load_tag;
+  reg_t* store_tag = tlb_store_tag;
+  tlb_entry_t* data = tlb_data;
+  if (type != FETCH && (xlate_flags != 0 || (proc && !proc->state.debug_mode &&
+                                             get_field(proc->state.mstatus->read(), MSTATUS_MPRV)))) {
+    load_tag = xlate_tlb_load_tag[xlate_tlb_index(xlate_flags)];
+    store_tag = xlate_tlb_store_tag[xlate_tlb_index(xlate_flags)];
+    data = xlate_tlb_data[xlate_tlb_index(xlate_flags)];
+  } else if ((tlb_insn_tag[idx] & ~TLB_FLAGS) != expected_tag) {
     tlb_insn_tag[idx] = -1;
+  }
+
+  if ((load_tag[idx] & ~TLB_FLAGS) != expected_tag)
+    load_tag[idx] = -1;
+  if ((store_tag[idx] & ~TLB_FLAGS) != expected_tag)
+    store_tag[idx] = -1;
 
   if ((check_triggers_fetch && type == FETCH) ||
       (check_triggers_load && type == LOAD) ||
       (check_triggers_store && type == STORE))
     expected_tag |= TLB_CHECK_TRIGGERS;
+  if (tracer.interested_in_range(paddr, paddr + PGSIZE, type))
+    expected_tag |= TLB_CHECK_TRACER;
 
-  if (pmp_homogeneous(paddr & ~reg_t(PGSIZE - 1), PGSIZE)) {
+  // keep page-table pages and the watched page out of the store TLB; see
+  // pwc_insert and watch_store_page
+  bool pt_page = type == STORE && (pwc_pages.count(paddr >> PGSHIFT) ||
+                                   (paddr >> PGSHIFT) == watched_ppn);
+
+  if (pmp_cache_entry(paddr >> PGSHIFT)->homogeneous) {
     if (type == FETCH) tlb_insn_tag[idx] = expected_tag;
-    else if (type == STORE) tlb_store_tag[idx] = expected_tag;
-    else tlb_load_tag[idx] = expected_tag;
+    else if (type == STORE && !pt_page) store_tag[idx] = expected_tag;
+    else if (type == LOAD) load_tag[idx] = expected_tag;
   }
 
-  tlb_data[idx] = entry;
+  data[idx] = entry;
   return entry;
 }
 
+pmp_cache_entry_t* mmu_t::pmp_cache_entry(reg_t ppn)
+{
+  pmp_cache_entry_t* e = &pmp_cache[ppn % PMP_CACHE_ENTRIES];
+  if (e->ppn != ppn) {
+    e->ppn = ppn;
+    e->homogeneous = pmp_homogeneous(ppn << PGSHIFT, PGSIZE);
+    e->valid = e->ok = 0;
+  }
+  return e;
+}
+
 bool mmu_t::pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode)
 {
   if (!proc || proc->n_pmp == 0)
     return true;
 
+  // On a homogeneous page every access within the page matches the same
+  // PMP entry (or none), so one decision per mode and type covers them all.
+  reg_t ppn = addr >> PGSHIFT;
+  if (((addr + len - 1) >> PGSHIFT) != ppn)
+    return pmp_ok_uncached(addr, len, type, mode);
+
+  pmp_cache_entry_t* e = pmp_cache_entry(ppn);
+  if (!e->homogeneous)
+    return pmp_ok_uncached(addr, len, type, mode);
+
+  uint16_t bit = 1 << (mode * 3 + type);
+  if (!(e->valid & bit)) {
+    e->valid |= bit;
+    if (pmp_ok_uncached(ppn << PGSHIFT, 1 << PMP_SHIFT, type, mode))
+      e->ok |= bit;
+  }
+  return e->ok & bit;
+}
+
+bool mmu_t::pmp_ok_uncached(reg_t addr, reg_t len, access_type type, reg_t mode)
+{
   for (size_t i = 0; i < proc->n_pmp; i++) {
     // Check each 4-byte sector of the access
     bool any_match = false;
@@ -278,9 +462,11 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
 
   bool mxr = proc->state.sstatus->readvirt(false) & MSTATUS_MXR;
 
-  reg_t base = vm.ptbase;
+  reg_t hgatp = proc->get_state()->hgatp->read();
+  reg_t base;
   if ((gpa & ~maxgpa) == 0) {
-    for (int i = vm.levels - 1; i >= 0; i--) {
+    int start = pwc_lookup(true, true, hgatp, 0, gpa, vm, &base);
+    for (int i = start; i >= 0; i--) {
       int ptshift = i * vm.idxbits;
       int idxbits = (i == (vm.levels - 1)) ? vm.idxbits + vm.widenbits : vm.idxbits;
       reg_t idx = (gpa >> (PGSHIFT + ptshift)) & ((reg_t(1) << idxbits) - 1);
@@ -291,6 +477,7 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
       if (!ppte || !pmp_ok(pte_paddr, vm.ptesize, LOAD, PRV_S)) {
         throw_access_exception(virt, gva, trap_type);
       }
+      cur_walk_pte_reads++;
 
       reg_t pte = vm.ptesize == 4 ? from_target(*(target_endian<uint32_t>*)ppte) : from_target(*(target_endian<uint64_t>*)ppte);
       reg_t ppn = (pte & ~reg_t(PTE_ATTR)) >> PTE_PPN_SHIFT;
@@ -308,6 +495,7 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
         if (pte & (PTE_D | PTE_A | PTE_U | PTE_N | PTE_PBMT))
           break;
         base = ppn << PGSHIFT;
+        pwc_insert(true, true, hgatp, 0, gpa, vm, i, base, pte_paddr);
       } else if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) {
         break;
       } else if (!(pte & PTE_U)) {
@@ -374,8 +562,10 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
   if (masked_msbs != 0 && masked_msbs != mask)
     vm.levels = 0;
 
+  reg_t gatp = virt ? proc->get_state()->hgatp->read() : 0;
   reg_t base = vm.ptbase;
-  for (int i = vm.levels - 1; i >= 0; i--) {
+  int start = vm.levels > 1 ? pwc_lookup(false, virt, satp, gatp, addr, vm, &base) : vm.levels - 1;
+  for (int i = start; i >= 0; i--) {
     int ptshift = i * vm.idxbits;
     reg_t idx = (addr >> (PGSHIFT + ptshift)) & ((1 << vm.idxbits) - 1);
 
@@ -384,6 +574,7 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
     auto ppte = sim->addr_to_mem(pte_paddr);
     if (!ppte || !pmp_ok(pte_paddr, vm.ptesize, LOAD, PRV_S))
       throw_access_exception(virt, addr, type);
+    cur_walk_pte_reads++;
 
     reg_t pte = vm.ptesize == 4 ? from_target(*(target_endian<uint32_t>*)ppte) : from_target(*(target_endian<uint64_t>*)ppte);
     reg_t ppn = (pte & ~reg_t(PTE_ATTR)) >> PTE_PPN_SHIFT;
@@ -401,6 +592,7 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
       if (pte & (PTE_D | PTE_A | PTE_U | PTE_N | PTE_PBMT))
         break;
       base = ppn << PGSHIFT;
+      pwc_insert(false, virt, satp, gatp, addr, vm, i, base, pte_paddr);
     } else if ((pte & PTE_U) ? s_mode && (type == FETCH || !sum) : !s_mode) {
       break;
     } else if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) {
@@ -450,6 +642,15 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
 
 void mmu_t::register_memtracer(memtracer_t* t)
 {
+  flush_trace();
   flush_tlb();
   tracer.hook(t);
 }
+
+void mmu_t::flush_trace()
+{
+  if (trace_buffer_len) {
+    tracer.trace_batch(trace_buffer, trace_buffer_len);
+    trace_buffer_len = 0;
+  }
+}
@@ -14,6 +14,7 @@
 #include "triggers.h"
 #include <stdlib.h>
 #include <vector>
+#include <unordered_set>
 
 // virtual memory configuration
 #define PGSHIFT 12
@@ -21,6 +22,19 @@ const reg_t PGSIZE = 1 << PGSHIFT;
 const reg_t PGMASK = ~(PGSIZE-1);
 #define MAX_PADDR_BITS 56 // imposed by Sv39 / Sv48
 
+// access a target-endian value at a possibly unaligned host address
+template<typename T> static inline target_endian<T> unaligned_host_load(const char* p)
+{
+  target_endian<T> v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+template<typename T> static inline void unaligned_host_store(char* p, target_endian<T> v)
+{
+  memcpy(p, &v, sizeof(v));
+}
+
 struct insn_fetch_t
 {
   insn_func_t func;
@@ -31,6 +45,9 @@ struct icache_entry_t {
   reg_t tag;
   struct icache_entry_t* next;
   insn_fetch_t data;
+#ifdef RISCV_ENABLE_HISTOGRAM
+  uint64_t count; // executions not yet added to the processor's histogram
+#endif
 };
 
 struct tlb_entry_t {
@@ -38,6 +55,33 @@ struct tlb_entry_t {
   reg_t target_offset;
 };
 
+// a cached non-leaf PTE: the next-level table for the VPN prefix at level
+struct pwc_entry_t {
+  reg_t root;   // satp/vsatp, or hgatp for G-stage entries
+  reg_t gatp;   // hgatp the VS-stage entry was walked under
+  reg_t prefix; // VPN bits above this level
+  reg_t base;   // physical (or guest-physical) base of the next-level table
+  int level;    // -1 if invalid
+  bool stage2;
+  bool virt;
+};
+
+// cached PMP decisions for one physical page
+struct pmp_cache_entry_t {
+  reg_t ppn;         // -1 if invalid
+  bool homogeneous;  // no PMP region partially covers the page
+  uint16_t valid;    // bit (mode * 3 + type) is set once ok bit is known
+  uint16_t ok;
+};
+
+struct vm_info {
+  int levels;
+  int idxbits;
+  int widenbits;
+  int ptesize;
+  reg_t ptbase;
+};
+
 // this class implements a processor's port into the virtual memory system.
 // an MMU and instruction cache are maintained for simulator performance.
 class mmu_t
@@ -52,9 +96,53 @@ public:
 #define RISCV_XLATE_VIRT (1U << 0)
 #define RISCV_XLATE_VIRT_HLVX (1U << 1)
 
+#ifndef RISCV_ENABLE_COMMITLOG
+# define READ_MEM(addr, size) ({})
+#else
+# define READ_MEM(addr, size) \
+  proc->state.log_mem_read.push_back(std::make_tuple(addr, 0, size));
+#endif
+
+#ifndef RISCV_ENABLE_COMMITLOG
+# define WRITE_MEM(addr, value, size) ({})
+#else
+# define WRITE_MEM(addr, val, size) \
+  proc->state.log_mem_write.push_back(std::make_tuple(addr, val, size));
+#endif
+
+  // return the host address of vaddr if the TLB used by accesses of this
+  // type and xlate_flags maps it and no triggers need to be checked
+  inline char* tlb_host_addr(reg_t vaddr, access_type type, uint32_t xlate_flags)
+  {
+    reg_t vpn = vaddr >> PGSHIFT;
+    reg_t idx = vpn % TLB_ENTRIES;
+    if (xlate_flags == 0) {
+      reg_t* tags = type == STORE ? tlb_store_tag : tlb_load_tag;
+      if (tags[idx] == vpn)
+        return tlb_data[idx].host_offset + vaddr;
+    }
+    unsigned t = xlate_tlb_index(xlate_flags);
+    reg_t* tags = type == STORE ? xlate_tlb_store_tag[t] : xlate_tlb_load_tag[t];
+    if (tags[idx] == vpn)
+      return xlate_tlb_data[t][idx].host_offset + vaddr;
+    return NULL;
+  }
+
   inline reg_t misaligned_load(reg_t addr, size_t size, uint32_t xlate_flags)
   {
 #ifdef RISCV_ENABLE_MISALIGNED
+    // an access within one page that hits in the TLB is done in one piece
+    if (((addr ^ (addr + size - 1)) >> PGSHIFT) == 0) {
+      if (char* host_addr = tlb_host_addr(addr, LOAD, xlate_flags)) {
+        if (proc) READ_MEM(addr, size);
+        switch (size) {
+          case 2: return from_target(unaligned_host_load<uint16_t>(host_addr));
+          case 4: return from_target(unaligned_host_load<uint32_t>(host_addr));
+          case 8: return from_target(unaligned_host_load<uint64_t>(host_addr));
+        }
+      }
+    }
+
     reg_t res = 0;
     for (size_t i = 0; i < size; i++)
       res += (reg_t)load_uint8(addr + (target_big_endian? size-1-i : i)) << (i * 8);
@@ -68,6 +156,21 @@ public:
   inline void misaligned_store(reg_t addr, reg_t data, size_t size, uint32_t xlate_flags, bool actually_store=true)
   {
 #ifdef RISCV_ENABLE_MISALIGNED
+    if (((addr ^ (addr + size - 1)) >> PGSHIFT) == 0) {
+      if (char* host_addr = tlb_host_addr(addr, STORE, xlate_flags)) {
+        if (actually_store) {
+          if (proc) WRITE_MEM(addr, data, size);
+          switch (size) {
+            case 2: unaligned_host_store(host_addr, to_target((uint16_t)data)); return;
+            case 4: unaligned_host_store(host_addr, to_target((uint32_t)data)); return;
+            case 8: unaligned_host_store(host_addr, to_target((uint64_t)data)); return;
+          }
+        } else {
+          return;
+        }
+      }
+    }
+
     for (size_t i = 0; i < size; i++)
       store_uint8(addr + (target_big_endian? size-1-i : i), data >> (i * 8), actually_store);
 #else
@@ -76,13 +179,6 @@ public:
 #endif
   }
 
-#ifndef RISCV_ENABLE_COMMITLOG
-# define READ_MEM(addr, size) ({})
-#else
-# define READ_MEM(addr, size) \
-  proc->state.log_mem_read.push_back(std::make_tuple(addr, 0, size));
-#endif
-
   // template for functions that load an aligned value from memory
   #define load_func(type, prefix, xlate_flags) \
     inline type##_t prefix##_##type(reg_t addr, bool require_alignment = false) { \
@@ -96,13 +192,25 @@ public:
         if (proc) READ_MEM(addr, size); \
         return from_target(*(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr)); \
       } \
-      if ((xlate_flags) == 0 && unlikely(tlb_load_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
-        type##_t data = from_target(*(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr)); \
-        if (!matched_trigger) { \
+      reg_t* tags = tlb_load_tag; \
+      tlb_entry_t* entries = tlb_data; \
+      if ((xlate_flags) != 0 || (tlb_load_tag[vpn % TLB_ENTRIES] & ~TLB_FLAGS) != vpn) { \
+        tags = xlate_tlb_load_tag[xlate_tlb_index(xlate_flags)]; \
+        entries = xlate_tlb_data[xlate_tlb_index(xlate_flags)]; \
+        if (likely(tags[vpn % TLB_ENTRIES] == vpn)) { \
+          if (proc) READ_MEM(addr, size); \
+          return from_target(*(target_endian<type##_t>*)(entries[vpn % TLB_ENTRIES].host_offset + addr)); \
+        } \
+      } \
+      if (unlikely((tags[vpn % TLB_ENTRIES] & ~TLB_FLAGS) == vpn)) { \
+        type##_t data = from_target(*(target_endian<type##_t>*)(entries[vpn % TLB_ENTRIES].host_offset + addr)); \
+        if ((tags[vpn % TLB_ENTRIES] & TLB_CHECK_TRIGGERS) && !matched_trigger) { \
           matched_trigger = trigger_exception(triggers::OPERATION_LOAD, addr, data); \
           if (matched_trigger) \
             throw *matched_trigger; \
         } \
+        if (tags[vpn % TLB_ENTRIES] & TLB_CHECK_TRACER) \
+          trace_access(entries[vpn % TLB_ENTRIES].target_offset + addr, size, LOAD); \
         if (proc) READ_MEM(addr, size); \
         return data; \
       } \
@@ -138,13 +246,6 @@ public:
   load_func(int32, guest_load, RISCV_XLATE_VIRT)
   load_func(int64, guest_load, RISCV_XLATE_VIRT)
 
-#ifndef RISCV_ENABLE_COMMITLOG
-# define WRITE_MEM(addr, value, size) ({})
-#else
-# define WRITE_MEM(addr, val, size) \
-  proc->state.log_mem_write.push_back(std::make_tuple(addr, val, size));
-#endif
-
   // template for functions that store an aligned value to memory
   #define store_func(type, prefix, xlate_flags) \
     void prefix##_##type(reg_t addr, type##_t val, bool actually_store=true, bool require_alignment=false) { \
@@ -159,16 +260,31 @@ public:
           if (proc) WRITE_MEM(addr, val, size); \
           *(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
         } \
+        return; \
+      } \
+      reg_t* tags = tlb_store_tag; \
+      tlb_entry_t* entries = tlb_data; \
+      if ((xlate_flags) != 0 || (tlb_store_tag[vpn % TLB_ENTRIES] & ~TLB_FLAGS) != vpn) { \
+        tags = xlate_tlb_store_tag[xlate_tlb_index(xlate_flags)]; \
+        entries = xlate_tlb_data[xlate_tlb_index(xlate_flags)]; \
+      } \
+      if (likely(tags[vpn % TLB_ENTRIES] == vpn)) { \
+        if (actually_store) { \
+          if (proc) WRITE_MEM(addr, val, size); \
+          *(target_endian<type##_t>*)(entries[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
+        } \
       } \
-      else if ((xlate_flags) == 0 && unlikely(tlb_store_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
+      else if (unlikely((tags[vpn % TLB_ENTRIES] & ~TLB_FLAGS) == vpn)) { \
         if (actually_store) { \
-          if (!matched_trigger) { \
+          if ((tags[vpn % TLB_ENTRIES] & TLB_CHECK_TRIGGERS) && !matched_trigger) { \
             matched_trigger = trigger_exception(triggers::OPERATION_STORE, addr, val); \
             if (matched_trigger) \
               throw *matched_trigger; \
           } \
+          if (tags[vpn % TLB_ENTRIES] & TLB_CHECK_TRACER) \
+            trace_access(entries[vpn % TLB_ENTRIES].target_offset + addr, size, STORE); \
           if (proc) WRITE_MEM(addr, val, size); \
-          *(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
+          *(target_endian<type##_t>*)(entries[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
         } \
       } \
       else { \
@@ -240,8 +356,28 @@ public:
   amo_func(uint32)
   amo_func(uint64)
 
+  // translate the len bytes at addr, which must not cross a page, once for
+  // an access of the given type, and return the host address through which
+  // they can be accessed directly.  Returns NULL if they aren't ordinary RAM
+  // or if tracers, triggers or the commit log need to see every access; the
+  // caller should then fall back to the load/store functions.
+  inline char* bulk_host_addr(reg_t addr, reg_t len, access_type type)
+  {
+#ifdef RISCV_ENABLE_COMMITLOG
+    if (proc && proc->get_log_commits_enabled())
+      return NULL;
+#endif
+    if (char* host_addr = tlb_host_addr(addr, type, 0))
+      return host_addr;
+    return bulk_slow_path(addr, len, type);
+  }
+
   void cbo_zero(reg_t addr) {
     auto base = addr & ~(blocksz - 1);
+    if (char* host_addr = bulk_host_addr(base, blocksz, STORE)) {
+      memset(host_addr, 0, blocksz);
+      return;
+    }
     for (size_t offset = 0; offset < blocksz; offset += 1)
       store_uint8(base + offset, 0);
   }
@@ -251,8 +387,10 @@ public:
       reg_t paddr = addr & ~(blocksz - 1);
       paddr = translate(paddr, blocksz, LOAD, 0);
       if (auto host_addr = sim->addr_to_mem(paddr)) {
-        if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
+        if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD)) {
+          flush_trace();
           tracer.clean_invalidate(paddr, blocksz, clean, inval);
+        }
       } else {
         throw trap_store_access_fault((proc) ? proc->state.v : false, addr, 0, 0);
       }
@@ -339,8 +477,9 @@ public:
 
     reg_t paddr = tlb_entry.target_offset + addr;;
     if (tracer.interested_in_range(paddr, paddr + 1, FETCH)) {
-      entry->tag = -1;
-      tracer.trace(paddr, length, FETCH);
+      // keep the entry, but make access_icache trace each fetch from it
+      entry->tag = addr | ICACHE_TRACED;
+      trace_access(paddr, length, FETCH);
     }
     return entry;
   }
@@ -350,6 +489,16 @@ public:
     icache_entry_t* entry = &icache[icache_index(addr)];
     if (likely(entry->tag == addr))
       return entry;
+    if (unlikely(entry->tag == (addr | ICACHE_TRACED)) && entry->tag != reg_t(-1)) {
+      reg_t vpn = addr >> PGSHIFT;
+      tlb_entry_t tlb_entry = (tlb_insn_tag[vpn % TLB_ENTRIES] & ~TLB_FLAGS) == vpn ?
+        tlb_data[vpn % TLB_ENTRIES] : translate_insn_addr(addr);
+      trace_access(tlb_entry.target_offset + addr, insn_length(entry->data.insn.bits()), FETCH);
+      return entry;
+    }
+#ifdef RISCV_ENABLE_HISTOGRAM
+    spill_histogram(entry);
+#endif
     return refill_icache(addr, entry);
   }
 
@@ -359,8 +508,28 @@ public:
     return refill_icache(addr, &entry)->data;
   }
 
+#ifdef RISCV_ENABLE_HISTOGRAM
+  // adds an icache entry's execution count to the processor's PC histogram,
+  // before the entry is reused for another PC
+  inline void spill_histogram(icache_entry_t* entry)
+  {
+    if (entry->count && proc)
+      proc->pc_histogram[entry->tag & ~ICACHE_TRACED] += entry->count;
+    entry->count = 0;
+  }
+#endif
+
+  // keeps the physical page ppn out of the store TLB, so that every store
+  // to it reaches store_slow_path and is reported to simif_t::store_watched
+  void watch_store_page(reg_t ppn);
+
   void flush_tlb();
   void flush_icache();
+  void flush_trace();
+  void flush_pwc();
+  void flush_pmp_cache();
+
+  void print_stats();
 
   void register_memtracer(memtracer_t*);
 
@@ -419,21 +588,88 @@ private:
   uint16_t fetch_temp;
   uint64_t blocksz;
 
-  // implement an instruction cache for simulator performance
+  // implement an instruction cache for simulator performance.  Entries for
+  // traced fetches are tagged with ICACHE_TRACED set, which no PC has.
   icache_entry_t icache[ICACHE_ENTRIES];
+  static const reg_t ICACHE_TRACED = 1;
+
+  // accesses to traced memory are buffered here and handed to the tracers in
+  // batches, so that traced pages can stay in the TLB and instruction cache.
+  // The buffer is drained at the end of every processor_t::step, which keeps
+  // the accesses of different harts in simulation order.
+  static const size_t TRACE_BUFFER_ENTRIES = 1024;
+  memtrace_entry_t trace_buffer[TRACE_BUFFER_ENTRIES];
+  size_t trace_buffer_len;
+
+  inline void trace_access(reg_t paddr, size_t bytes, access_type type)
+  {
+    if (unlikely(trace_buffer_len == TRACE_BUFFER_ENTRIES))
+      flush_trace();
+    trace_buffer[trace_buffer_len++] = {paddr, (uint32_t)bytes, type};
+  }
 
   // implement a TLB for simulator performance
   static const reg_t TLB_ENTRIES = 256;
   // If a TLB tag has TLB_CHECK_TRIGGERS set, then the MMU must check for a
   // trigger match before completing an access.
   static const reg_t TLB_CHECK_TRIGGERS = reg_t(1) << 63;
+  // If a TLB tag has TLB_CHECK_TRACER set, then the access must be recorded
+  // for the memory tracers.
+  static const reg_t TLB_CHECK_TRACER = reg_t(1) << 62;
+  static const reg_t TLB_FLAGS = TLB_CHECK_TRIGGERS | TLB_CHECK_TRACER;
   tlb_entry_t tlb_data[TLB_ENTRIES];
   reg_t tlb_insn_tag[TLB_ENTRIES];
   reg_t tlb_load_tag[TLB_ENTRIES];
   reg_t tlb_store_tag[TLB_ENTRIES];
 
+  // data accesses made under MPRV, and HLV/HSV/HLVX accesses, are translated
+  // differently from instruction fetches, so they are cached in TLBs of their
+  // own, one per kind of access.  These are flushed along with the main TLB,
+  // which also happens whenever the effective privilege or virtualization
+  // mode these accesses use can change.
+  static const unsigned XLATE_TLBS = 3;
+  tlb_entry_t xlate_tlb_data[XLATE_TLBS][TLB_ENTRIES];
+  reg_t xlate_tlb_load_tag[XLATE_TLBS][TLB_ENTRIES];
+  reg_t xlate_tlb_store_tag[XLATE_TLBS][TLB_ENTRIES];
+  static constexpr unsigned xlate_tlb_index(uint32_t xlate_flags)
+  {
+    return xlate_flags == 0 ? 0 : (xlate_flags & RISCV_XLATE_VIRT_HLVX) ? 2 : 1;
+  }
+
+  // implement a paging-structure cache of non-leaf PTEs so that TLB misses
+  // needn't re-read the upper levels of the page table.  Only PTEs whose
+  // validity doesn't depend on privilege or envcfg state are cached, so
+  // unlike the TLB it survives privilege changes; it is flushed by
+  // SFENCE/HFENCE, PMP writes, and stores to any page holding a cached PTE.
+  // Such pages are kept out of the store TLB so those stores reach
+  // store_slow_path.
+  static const reg_t PWC_ENTRIES = 64;
+  pwc_entry_t pwc[PWC_ENTRIES];
+  std::unordered_set<reg_t> pwc_pages;
+
+  // see watch_store_page
+  reg_t watched_ppn;
+
+  // implement a per-page cache of PMP decisions, so that neither TLB refills
+  // nor uncached accesses need to scan every PMP entry.  Decisions are only
+  // cached for pages that are homogeneous with respect to the PMP, and are
+  // filled in lazily per privilege mode and access type.  The cache is
+  // flushed on any write to pmpcfg, pmpaddr or mseccfg.
+  static const reg_t PMP_CACHE_ENTRIES = 256;
+  pmp_cache_entry_t pmp_cache[PMP_CACHE_ENTRIES];
+
+  // page-walk statistics, reported by print_stats()
+  reg_t walk_count;
+  reg_t walk_pte_reads;
+  reg_t cur_walk_pte_reads;
+  reg_t pwc_lookups;
+  reg_t pwc_hits;
+
+  int pwc_lookup(bool stage2, bool virt, reg_t root, reg_t gatp, reg_t addr, const vm_info& vm, reg_t* base);
+  void pwc_insert(bool stage2, bool virt, reg_t root, reg_t gatp, reg_t addr, const vm_info& vm, int level, reg_t base, reg_t pte_paddr);
+
   // finish translation on a TLB miss and update the TLB
-  tlb_entry_t refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type);
+  tlb_entry_t refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type, uint32_t xlate_flags = 0);
   const char* fill_from_mmio(reg_t vaddr, reg_t paddr);
 
   // perform a stage2 translation for a given guest address
@@ -446,6 +682,7 @@ private:
   tlb_entry_t fetch_slow_path(reg_t addr);
   void load_slow_path(reg_t addr, reg_t len, uint8_t* bytes, uint32_t xlate_flags);
   void store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_t xlate_flags, bool actually_store);
+  char* bulk_slow_path(reg_t addr, reg_t len, access_type type);
   bool mmio_load(reg_t addr, size_t len, uint8_t* bytes);
   bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes);
   bool mmio_ok(reg_t addr, access_type type);
@@ -457,12 +694,12 @@ private:
     if (likely(tlb_insn_tag[vpn % TLB_ENTRIES] == vpn))
       return tlb_data[vpn % TLB_ENTRIES];
     tlb_entry_t result;
-    if (unlikely(tlb_insn_tag[vpn % TLB_ENTRIES] != (vpn | TLB_CHECK_TRIGGERS))) {
+    if (unlikely((tlb_insn_tag[vpn % TLB_ENTRIES] & ~TLB_FLAGS) != vpn)) {
       result = fetch_slow_path(addr);
     } else {
       result = tlb_data[vpn % TLB_ENTRIES];
     }
-    if (unlikely(tlb_insn_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) {
+    if (unlikely((tlb_insn_tag[vpn % TLB_ENTRIES] & ~TLB_CHECK_TRACER) == (vpn | TLB_CHECK_TRIGGERS))) {
       target_endian<uint16_t>* ptr = (target_endian<uint16_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr);
       triggers::action_t action;
       auto match = proc->TM.memory_access_match(&action, triggers::OPERATION_EXECUTE, addr, from_target(*ptr));
@@ -495,6 +732,8 @@ private:
 
   reg_t pmp_homogeneous(reg_t addr, reg_t len);
   bool pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode);
+  bool pmp_ok_uncached(reg_t addr, reg_t len, access_type type, reg_t mode);
+  pmp_cache_entry_t* pmp_cache_entry(reg_t ppn);
 
 #ifdef RISCV_ENABLE_DUAL_ENDIAN
   bool target_big_endian;
@@ -510,14 +749,6 @@ private:
   friend class processor_t;
 };
 
-struct vm_info {
-  int levels;
-  int idxbits;
-  int widenbits;
-  int ptesize;
-  reg_t ptbase;
-};
-
 inline vm_info decode_vm_info(int xlen, bool stage2, reg_t prv, reg_t satp)
 {
   if (prv == PRV_M) {
@@ -0,0 +1,187 @@
+#include "devices.h"
+#include <fesvr/term.h>
+
+/* 16550 registers, one byte apart (reg-shift 0):
+ * 0 receive buffer (read), transmit holding (write); divisor latch low
+ *   while LCR.DLAB is set
+ * 1 interrupt enable; divisor latch high while LCR.DLAB is set
+ * 2 interrupt identification (read), FIFO control (write)
+ * 3 line control      4 modem control      5 line status
+ * 6 modem status      7 scratch
+ */
+
+#define UART_RBR	0
+#define UART_THR	0
+#define UART_DLL	0
+#define UART_IER	1
+#define UART_DLM	1
+#define UART_IIR	2
+#define UART_FCR	2
+#define UART_LCR	3
+#define UART_MCR	4
+#define UART_LSR	5
+#define UART_MSR	6
+#define UART_SCR	7
+
+#define UART_IER_RDI	0x01	// receive data available
+#define UART_IER_THRI	0x02	// transmit holding register empty
+
+#define UART_IIR_NO_INT	0x01
+#define UART_IIR_THRI	0x02
+#define UART_IIR_RDI	0x04
+#define UART_IIR_FIFO	0xc0
+
+#define UART_FCR_ENABLE_FIFO	0x01
+#define UART_FCR_CLEAR_RCVR	0x02
+
+#define UART_LCR_DLAB	0x80
+
+#define UART_MCR_LOOP	0x10
+
+#define UART_LSR_DR	0x01
+#define UART_LSR_THRE	0x20
+#define UART_LSR_TEMT	0x40
+
+#define UART_MSR_CTS	0x10
+#define UART_MSR_DSR	0x20
+#define UART_MSR_DCD	0x80
+
+ns16550_t::ns16550_t(plic_t* plic, uint32_t interrupt_id)
+  : plic(plic), interrupt_id(interrupt_id), dll(0x0c), dlm(0), ier(0), fcr(0),
+    lcr(0), mcr(0), scr(0), thr_empty_pending(false), interrupt_level(false), ticks(0)
+{
+}
+
+bool ns16550_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  if (len != 1 || addr >= NS16550_SIZE)
+    return false;
+
+  uint8_t val = 0;
+  switch (addr) {
+    case UART_RBR:
+      if (lcr & UART_LCR_DLAB) {
+        val = dll;
+      } else if (!rx_fifo.empty()) {
+        val = rx_fifo.front();
+        rx_fifo.pop();
+      }
+      break;
+    case UART_IER:
+      val = lcr & UART_LCR_DLAB ? dlm : ier;
+      break;
+    case UART_IIR:
+      val = interrupt_identification();
+      // reading the IIR acknowledges a transmitter interrupt
+      if ((val & 0xf) == UART_IIR_THRI)
+        thr_empty_pending = false;
+      break;
+    case UART_LCR: val = lcr; break;
+    case UART_MCR: val = mcr; break;
+    case UART_LSR:
+      // output is taken as soon as it is written
+      val = UART_LSR_THRE | UART_LSR_TEMT | (rx_fifo.empty() ? 0 : UART_LSR_DR);
+      break;
+    case UART_MSR:
+      // in loopback, the modem outputs are fed back: RTS to CTS, DTR to DSR,
+      // OUT1 to RI and OUT2 to DCD
+      if (mcr & UART_MCR_LOOP)
+        val = ((mcr & 0x0c) << 4) | ((mcr & 0x02) << 3) | ((mcr & 0x01) << 5);
+      else
+        val = UART_MSR_DCD | UART_MSR_DSR | UART_MSR_CTS;
+      break;
+    case UART_SCR: val = scr; break;
+  }
+
+  bytes[0] = val;
+  update_interrupt();
+  return true;
+}
+
+bool ns16550_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+  if (len != 1 || addr >= NS16550_SIZE)
+    return false;
+
+  uint8_t val = bytes[0];
+  switch (addr) {
+    case UART_THR:
+      if (lcr & UART_LCR_DLAB) {
+        dll = val;
+        break;
+      }
+      if (mcr & UART_MCR_LOOP) {
+        if (rx_fifo.size() < FIFO_SIZE)
+          rx_fifo.push(val);
+      } else {
+        canonical_terminal_t::write(val);
+      }
+      thr_empty_pending = true;
+      break;
+    case UART_IER:
+      if (lcr & UART_LCR_DLAB) {
+        dlm = val;
+        break;
+      }
+      // the transmitter is always empty, so enabling its interrupt raises it
+      if ((val & UART_IER_THRI) && !(ier & UART_IER_THRI))
+        thr_empty_pending = true;
+      ier = val & 0x0f;
+      break;
+    case UART_FCR:
+      fcr = val & ~(UART_FCR_CLEAR_RCVR | 0x04);
+      if (val & UART_FCR_CLEAR_RCVR)
+        rx_fifo = std::queue<uint8_t>();
+      break;
+    case UART_LCR: lcr = val; break;
+    case UART_MCR: mcr = val & 0x1f; break;
+    case UART_LSR: break;
+    case UART_MSR: break;
+    case UART_SCR: scr = val; break;
+  }
+
+  update_interrupt();
+  return true;
+}
+
+void ns16550_t::tick()
+{
+  // partial lines are flushed and the terminal polled only every so many
+  // ticks, so an idle console costs next to nothing
+  if (++ticks < POLL_INTERVAL)
+    return;
+  ticks = 0;
+  canonical_terminal_t::flush();
+
+  if (mcr & UART_MCR_LOOP)
+    return;
+
+  bool received = false;
+  while (rx_fifo.size() < FIFO_SIZE) {
+    int ch = canonical_terminal_t::read();
+    if (ch < 0)
+      break;
+    rx_fifo.push(ch);
+    received = true;
+  }
+  if (received)
+    update_interrupt();
+}
+
+uint8_t ns16550_t::interrupt_identification()
+{
+  uint8_t fifo = fcr & UART_FCR_ENABLE_FIFO ? UART_IIR_FIFO : 0;
+  if ((ier & UART_IER_RDI) && !rx_fifo.empty())
+    return fifo | UART_IIR_RDI;
+  if ((ier & UART_IER_THRI) && thr_empty_pending)
+    return fifo | UART_IIR_THRI;
+  return fifo | UART_IIR_NO_INT;
+}
+
+void ns16550_t::update_interrupt()
+{
+  bool level = !(interrupt_identification() & UART_IIR_NO_INT);
+  if (plic && level != interrupt_level)
+    plic->set_interrupt_level(interrupt_id, level);
+  interrupt_level = level;
+}
@@ -5,6 +5,16 @@
 #define DEFAULT_RSTVEC     0x00001000
 #define CLINT_BASE         0x02000000
 #define CLINT_SIZE         0x000c0000
+#define PLIC_BASE          0x0c000000
+#define PLIC_SIZE          0x01000000
+#define PLIC_NDEV          31
+#define VIRTIO_BLK_BASE    0x10001000
+#define VIRTIO_MMIO_SIZE   0x00001000
+#define VIRTIO_BLK_IRQ     1
+#define NS16550_BASE       0x10000000
+#define NS16550_SIZE       0x00000100
+#define NS16550_IRQ        2
+#define NS16550_CLOCK_HZ   3686400
 #define EXT_IO_BASE        0x40000000
 #define DRAM_BASE          0x80000000
 
@@ -0,0 +1,163 @@
+#include "devices.h"
+#include "processor.h"
+
+/* 000000 source priorities (source 0 is reserved)
+ * 001000 pending bits
+ * 002000 enable bits, context 0
+ * 002080 enable bits, context 1
+ * 200000 priority threshold, context 0
+ * 200004 claim/complete, context 0
+ * 201000 priority threshold, context 1
+ * ...
+ *
+ * Context 2*i is hart i's M mode and context 2*i+1 its S mode.
+ */
+
+#define PRIORITY_BASE	0x0
+#define PENDING_BASE	0x1000
+#define ENABLE_BASE	0x2000
+#define ENABLE_STRIDE	0x80
+#define CONTEXT_BASE	0x200000
+#define CONTEXT_STRIDE	0x1000
+#define CONTEXT_THRESHOLD	0x0
+#define CONTEXT_CLAIM	0x4
+
+#define MAX_PRIORITY	7
+
+plic_t::plic_t(std::vector<processor_t*>& procs, uint32_t ndev)
+  : procs(procs), ndev(ndev), priority(ndev + 1), level(0), pending(0),
+    claimed(0), contexts(2 * procs.size())
+{
+  assert(ndev <= PLIC_NDEV);
+}
+
+bool plic_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  if (len != sizeof(uint32_t) || addr % sizeof(uint32_t))
+    return false;
+
+  uint32_t val = 0;
+  if (addr >= PRIORITY_BASE && addr < PENDING_BASE) {
+    uint32_t id = (addr - PRIORITY_BASE) / sizeof(uint32_t);
+    if (id > 0 && id <= ndev)
+      val = priority[id];
+  } else if (addr >= PENDING_BASE && addr < ENABLE_BASE) {
+    if (addr == PENDING_BASE)
+      val = pending;
+  } else if (addr >= ENABLE_BASE && addr < CONTEXT_BASE) {
+    size_t ctx = (addr - ENABLE_BASE) / ENABLE_STRIDE;
+    if (ctx < contexts.size() && (addr - ENABLE_BASE) % ENABLE_STRIDE == 0)
+      val = contexts[ctx].enable;
+  } else if (addr >= CONTEXT_BASE && addr < PLIC_SIZE) {
+    size_t ctx = (addr - CONTEXT_BASE) / CONTEXT_STRIDE;
+    if (ctx >= contexts.size())
+      return false;
+    switch ((addr - CONTEXT_BASE) % CONTEXT_STRIDE) {
+      case CONTEXT_THRESHOLD: val = contexts[ctx].threshold; break;
+      case CONTEXT_CLAIM: val = claim(ctx); break;
+    }
+  } else {
+    return false;
+  }
+
+  memcpy(bytes, &val, len);
+  return true;
+}
+
+bool plic_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+  if (len != sizeof(uint32_t) || addr % sizeof(uint32_t))
+    return false;
+
+  uint32_t val;
+  memcpy(&val, bytes, len);
+  if (addr >= PRIORITY_BASE && addr < PENDING_BASE) {
+    uint32_t id = (addr - PRIORITY_BASE) / sizeof(uint32_t);
+    if (id > 0 && id <= ndev)
+      priority[id] = std::min<uint32_t>(val, MAX_PRIORITY);
+  } else if (addr >= PENDING_BASE && addr < ENABLE_BASE) {
+    // pending bits are read-only
+  } else if (addr >= ENABLE_BASE && addr < CONTEXT_BASE) {
+    size_t ctx = (addr - ENABLE_BASE) / ENABLE_STRIDE;
+    if (ctx < contexts.size() && (addr - ENABLE_BASE) % ENABLE_STRIDE == 0)
+      contexts[ctx].enable = val & sources_mask();
+  } else if (addr >= CONTEXT_BASE && addr < PLIC_SIZE) {
+    size_t ctx = (addr - CONTEXT_BASE) / CONTEXT_STRIDE;
+    if (ctx >= contexts.size())
+      return false;
+    switch ((addr - CONTEXT_BASE) % CONTEXT_STRIDE) {
+      case CONTEXT_THRESHOLD: contexts[ctx].threshold = std::min<uint32_t>(val, MAX_PRIORITY); break;
+      case CONTEXT_CLAIM: complete(ctx, val); break;
+    }
+  } else {
+    return false;
+  }
+
+  update();
+  return true;
+}
+
+void plic_t::set_interrupt_level(uint32_t id, bool lvl)
+{
+  assert(id > 0 && id <= ndev);
+  uint32_t bit = uint32_t(1) << id;
+  if (lvl) {
+    level |= bit;
+    if (!(claimed & bit))
+      pending |= bit;
+  } else {
+    level &= ~bit;
+    pending &= ~bit;
+  }
+  update();
+}
+
+// the pending, enabled source with the highest priority above the
+// context's threshold, or 0 if there is none
+uint32_t plic_t::best_source(size_t ctx)
+{
+  uint32_t best = 0, best_priority = contexts[ctx].threshold;
+  uint32_t candidates = pending & contexts[ctx].enable;
+  for (uint32_t id = 1; id <= ndev; id++) {
+    if ((candidates >> id & 1) && priority[id] > best_priority) {
+      best = id;
+      best_priority = priority[id];
+    }
+  }
+  return best;
+}
+
+uint32_t plic_t::claim(size_t ctx)
+{
+  uint32_t id = best_source(ctx);
+  if (id) {
+    pending &= ~(uint32_t(1) << id);
+    claimed |= uint32_t(1) << id;
+    update();
+  }
+  return id;
+}
+
+void plic_t::complete(size_t ctx, uint32_t id)
+{
+  if (id == 0 || id > ndev)
+    return;
+
+  uint32_t bit = uint32_t(1) << id;
+  if (!(claimed & bit))
+    return;
+
+  claimed &= ~bit;
+  if (level & bit)
+    pending |= bit;
+}
+
+void plic_t::update()
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    auto mip = procs[i]->get_state()->mip;
+    mip->backdoor_write_with_mask(MIP_MEIP, best_source(2 * i) ? MIP_MEIP : 0);
+    if (procs[i]->extension_enabled('S'))
+      mip->backdoor_write_with_mask(MIP_SEIP, best_source(2 * i + 1) ? MIP_SEIP : 0);
+  }
+}
@@ -27,7 +27,7 @@ processor_t::processor_t(const isa_parser_t *isa, const char* varch,
                          simif_t* sim, uint32_t id, bool halt_on_reset,
                          FILE* log_file, std::ostream& sout_)
   : debug(false), halt_request(HR_NONE), isa(isa), sim(sim), id(id), xlen(0),
-  histogram_enabled(false), log_commits_enabled(false),
+  histogram_enabled(false), log_commits_enabled(false), commit_log_writer(NULL),
   log_file(log_file), sout_(sout_.rdbuf()), halt_on_reset(halt_on_reset),
   impl_table(256, false), last_pc(1), executions(1), TM(4)
 {
@@ -68,17 +68,51 @@ processor_t::~processor_t()
 {
 #ifdef RISCV_ENABLE_HISTOGRAM
   if (histogram_enabled)
-  {
-    fprintf(stderr, "PC Histogram size:%zu\n", pc_histogram.size());
-    for (auto it : pc_histogram)
-      fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.first, it.second);
-  }
+    print_histogram();
 #endif
 
   delete mmu;
   delete disassembler;
 }
 
+#ifdef RISCV_ENABLE_HISTOGRAM
+// Prints the PCs, then the ELF symbols they fall in, hottest first.
+void processor_t::print_histogram()
+{
+  mmu->flush_icache(); // collects the counts still held in the icache
+
+  typedef std::pair<reg_t, uint64_t> pc_count_t;
+  std::vector<pc_count_t> pcs(pc_histogram.begin(), pc_histogram.end());
+  std::sort(pcs.begin(), pcs.end(), [](const pc_count_t& a, const pc_count_t& b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+
+  uint64_t total = 0;
+  fprintf(stderr, "PC Histogram size:%zu\n", pcs.size());
+  for (auto it : pcs) {
+    fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.first, it.second);
+    total += it.second;
+  }
+
+  // symbol names are owned by the simulator and outlive this map
+  std::unordered_map<const char*, uint64_t> symbol_histogram;
+  for (auto it : pcs) {
+    const char* sym = sim->get_nearest_symbol(it.first);
+    symbol_histogram[sym && *sym ? sym : "<unknown>"] += it.second;
+  }
+
+  typedef std::pair<const char*, uint64_t> symbol_count_t;
+  std::vector<symbol_count_t> symbols(symbol_histogram.begin(), symbol_histogram.end());
+  std::sort(symbols.begin(), symbols.end(), [](const symbol_count_t& a, const symbol_count_t& b) {
+    return a.second != b.second ? a.second > b.second : strcmp(a.first, b.first) < 0;
+  });
+
+  fprintf(stderr, "Symbol Histogram size:%zu\n", symbols.size());
+  for (auto it : symbols)
+    fprintf(stderr, "%s %" PRIu64 " %.2f%%\n", it.first, it.second, 100.0 * it.second / total);
+}
+#endif
+
 static void bad_option_string(const char *option, const char *value,
                               const char *msg)
 {
@@ -319,7 +353,7 @@ void state_t::reset(processor_t* const proc, reg_t max_isa)
   const reg_t hstatus_mask = HSTATUS_VTSR | HSTATUS_VTW
     | (proc->supports_impl(IMPL_MMU) ? HSTATUS_VTVM : 0)
     | HSTATUS_HU | HSTATUS_SPVP | HSTATUS_SPV | HSTATUS_GVA;
-  csrmap[CSR_HSTATUS] = hstatus = std::make_shared<masked_csr_t>(proc, CSR_HSTATUS, hstatus_mask, hstatus_init);
+  csrmap[CSR_HSTATUS] = hstatus = std::make_shared<hstatus_csr_t>(proc, CSR_HSTATUS, hstatus_mask, hstatus_init);
   csrmap[CSR_HGEIE] = std::make_shared<const_csr_t>(proc, CSR_HGEIE, 0);
   csrmap[CSR_HGEIP] = std::make_shared<const_csr_t>(proc, CSR_HGEIP, 0);
   csrmap[CSR_HIDELEG] = hideleg = std::make_shared<hideleg_csr_t>(proc, CSR_HIDELEG, mideleg);
@@ -486,9 +520,10 @@ void processor_t::set_histogram(bool value)
 }
 
 #ifdef RISCV_ENABLE_COMMITLOG
-void processor_t::enable_log_commits()
+void processor_t::enable_log_commits(commit_log_writer_t* binary_writer)
 {
   log_commits_enabled = true;
+  commit_log_writer = binary_writer;
 }
 #endif
 
@@ -499,6 +534,8 @@ void processor_t::reset()
   state.dcsr->halt = halt_on_reset;
   halt_on_reset = false;
   VU.reset();
+  mmu->flush_pwc();
+  mmu->flush_pmp_cache();
 
   if (n_pmp > 0) {
     // For backwards compatibility with software that is unaware of PMP,
@@ -542,6 +579,7 @@ void processor_t::set_pmp_num(reg_t n)
     abort();
   }
   n_pmp = n;
+  mmu->flush_pmp_cache();
 }
 
 void processor_t::set_pmp_granularity(reg_t gran)
@@ -553,6 +591,7 @@ void processor_t::set_pmp_granularity(reg_t gran)
   }
 
   lg_pmp_granularity = ctz(gran);
+  mmu->flush_pmp_cache();
 }
 
 void processor_t::set_mmu_capability(int cap)
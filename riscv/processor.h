@@ -24,6 +24,7 @@ class simif_t;
 class trap_t;
 class extension_t;
 class disassembler_t;
+class commit_log_writer_t;
 
 reg_t illegal_instruction(processor_t* p, insn_t insn, reg_t pc);
 
@@ -50,11 +51,128 @@ struct insn_desc_t
   }
 };
 
-// regnum, data
-typedef std::unordered_map<reg_t, freg_t> commit_log_reg_t;
+// List for the commit log's per-instruction bookkeeping, which is cleared
+// and refilled on every instruction.  The first N items are kept inline,
+// which covers every scalar instruction; the rare instruction that logs
+// more (e.g. a vector access) moves the list to the heap, whose storage is
+// then reused by later instructions.
+template<typename T, size_t N>
+class commit_log_array_t
+{
+public:
+  commit_log_array_t() : n(0) {}
+
+  void clear()
+  {
+    n = 0;
+    spilled.clear();
+  }
+  void push_back(const T& item)
+  {
+    if (likely(n < N && spilled.empty())) {
+      items[n++] = item;
+      return;
+    }
+    if (spilled.empty())
+      spilled.assign(items, items + n);
+    spilled.push_back(item);
+    n++;
+  }
+
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  T* begin() { return spilled.empty() ? items : spilled.data(); }
+  T* end() { return begin() + n; }
+  const T* begin() const { return spilled.empty() ? items : spilled.data(); }
+  const T* end() const { return begin() + n; }
+
+private:
+  size_t n;
+  T items[N];
+  std::vector<T> spilled;
+};
+
+// Registers written by one instruction, keyed by (regnum << 4) | type.
+// Scalar registers and CSRs are kept in the order first written; vector
+// registers are written an element at a time, so they only set a dirty bit
+// and are iterated after the others, in register order, with no data (the
+// value is read from the register file when the log is printed).
+class commit_log_reg_t
+{
+public:
+  typedef std::pair<reg_t, freg_t> item_t;
+
+  // an instruction writes at most one x or f register, but a trap taken
+  // in the middle of it may write a handful of CSRs on top of its own
+  static const size_t INLINE_ITEMS = 16;
+
+  commit_log_reg_t() : vregs(0) {}
+
+  void clear()
+  {
+    items.clear();
+    vregs = 0;
+  }
+
+  // the value logged for key, added if not yet written by this instruction
+  freg_t& operator[](reg_t key)
+  {
+    for (auto& item : items)
+      if (item.first == key)
+        return item.second;
+    items.push_back({key, freg_t()});
+    return items.end()[-1].second;
+  }
+
+  void write_vreg(reg_t vreg) { vregs |= uint32_t(1) << vreg; }
+
+  class const_iterator
+  {
+  public:
+    const_iterator(const item_t* item, const item_t* scalar_end, uint32_t vregs)
+      : item(item), scalar_end(scalar_end), vregs(vregs) {}
+
+    item_t operator*() const
+    {
+      if (item != scalar_end)
+        return *item;
+      return {(reg_t(__builtin_ctz(vregs)) << 4) | 2, freg_t()};
+    }
+    const_iterator& operator++()
+    {
+      if (item != scalar_end)
+        item++;
+      else
+        vregs &= vregs - 1;
+      return *this;
+    }
+    bool operator!=(const const_iterator& other) const
+    {
+      return item != other.item || vregs != other.vregs;
+    }
+
+  private:
+    const item_t* item;
+    const item_t* scalar_end;
+    uint32_t vregs;
+  };
+
+  const_iterator begin() const { return {items.begin(), items.end(), vregs}; }
+  const_iterator end() const { return {items.end(), items.end(), 0}; }
+
+private:
+  commit_log_array_t<item_t, INLINE_ITEMS> items;
+  uint32_t vregs;
+};
+
+// Memory accesses one instruction logs without going to the heap: a scalar
+// access logs one, or one per byte when split for misalignment, and an AMO
+// logs a read and a write.  Vector accesses may log up to 8 registers'
+// worth of elements and take the heap path.
+static const size_t COMMIT_LOG_INLINE_MEM_ITEMS = 16;
 
 // addr, value, size
-typedef std::vector<std::tuple<reg_t, uint64_t, uint8_t>> commit_log_mem_t;
+typedef commit_log_array_t<std::tuple<reg_t, uint64_t, uint8_t>, COMMIT_LOG_INLINE_MEM_ITEMS> commit_log_mem_t;
 
 enum VRM{
   RNU = 0,
@@ -204,6 +322,13 @@ struct state_t
   reg_t last_inst_priv;
   int last_inst_xlen;
   int last_inst_flen;
+
+  // binary commit log records not yet handed to the writer, and the state
+  // they are delta-encoded against
+  std::vector<uint8_t> log_buffer;
+  reg_t log_next_pc;
+  int log_xlen;
+  int log_flen;
 #endif
 };
 
@@ -236,8 +361,10 @@ public:
   void set_debug(bool value);
   void set_histogram(bool value);
 #ifdef RISCV_ENABLE_COMMITLOG
-  void enable_log_commits();
+  // with a writer, commits are logged in the binary format instead of text
+  void enable_log_commits(commit_log_writer_t* binary_writer = NULL);
   bool get_log_commits_enabled() const { return log_commits_enabled; }
+  commit_log_writer_t* get_commit_log_writer() { return commit_log_writer; }
 #endif
   void reset();
   void step(size_t n); // run for n cycles
@@ -336,13 +463,17 @@ private:
   unsigned xlen;
   bool histogram_enabled;
   bool log_commits_enabled;
+  commit_log_writer_t* commit_log_writer;
   FILE *log_file;
   std::ostream sout_; // needed for socket command interface -s, also used for -d and -l, but not for --log
   bool halt_on_reset;
   std::vector<bool> impl_table;
 
   std::vector<insn_desc_t> instructions;
-  std::map<reg_t,uint64_t> pc_histogram;
+  // Execution counts per PC.  The fast path counts in the icache entries,
+  // which add their counts here when they are refilled or flushed, so this
+  // is only updated per instruction on the slow path.
+  std::unordered_map<reg_t,uint64_t> pc_histogram;
 
   static const size_t OPCODE_CACHE_SIZE = 8191;
   insn_desc_t opcode_cache[OPCODE_CACHE_SIZE];
@@ -354,6 +485,7 @@ private:
   int paddr_bits();
 
   void enter_debug_mode(uint8_t cause);
+  void print_histogram();
 
   void debug_output_log(std::stringstream *s); // either output to interactive user or write to log file
 
@@ -410,7 +542,7 @@ public:
 
 #ifdef RISCV_ENABLE_COMMITLOG
           if (is_write)
-            p->get_state()->log_reg_write[((vReg) << 4) | 2] = {0, 0};
+            p->get_state()->log_reg_write.write_vreg(vReg);
 #endif
 
           T *regStart = (T*)((char*)reg_file + vReg * (VLEN >> 3));
@@ -0,0 +1,226 @@
+// See LICENSE for license details.
+
+#include "reuse_profiler.h"
+#include "common.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+static void help()
+{
+  std::cerr << "Reuse profiler configurations must be of the form" << std::endl;
+  std::cerr << "  interval[:rate]" << std::endl;
+  std::cerr << "where interval is the number of instructions per histogram (0 for" << std::endl;
+  std::cerr << "none) and rate, in (0, 1], is the fraction of lines sampled." << std::endl;
+  exit(1);
+}
+
+reuse_profiler_t* reuse_profiler_t::construct(const char* config, const char* name)
+{
+  char* end;
+  uint64_t interval = strtoull(config, &end, 0);
+  double rate = 1;
+  if (end == config)
+    help();
+  if (*end == ':') {
+    const char* r = end + 1;
+    rate = strtod(r, &end);
+    if (end == r)
+      help();
+  }
+  if (*end != '\0' || !(rate > 0 && rate <= 1))
+    help();
+  return new reuse_profiler_t(name, interval, rate);
+}
+
+reuse_profiler_t::reuse_profiler_t(const char* _name, uint64_t _interval, double rate,
+                                   size_t _max_lines)
+  : name(_name), interval(_interval), max_lines(_max_lines),
+    threshold(std::max<uint64_t>(1, rate * HASH_RANGE)),
+    tree(2 * _max_lines + 1), now(0),
+    insns(0), interval_index(0), interval_insns(0), interval_ws(0)
+{
+  lines.reserve(max_lines);
+}
+
+static uint64_t line_hash(uint64_t x)
+{
+  // splitmix64 finalizer
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+void reuse_profiler_t::histogram_t::add(uint64_t distance, double weight)
+{
+  size_t b = 0;
+  while (distance) {
+    distance >>= 1;
+    b++;
+  }
+  buckets[std::min(b, BUCKETS - 1)] += weight;
+  refs += weight;
+}
+
+void reuse_profiler_t::trace(uint64_t addr, size_t bytes, access_type type)
+{
+  for (uint64_t line = addr >> LINE_SHIFT; line <= (addr + bytes - 1) >> LINE_SHIFT; line++)
+    access(line);
+
+  if (type == FETCH) {
+    insns++;
+    if (++interval_insns == interval)
+      end_interval();
+  }
+}
+
+void reuse_profiler_t::access(uint64_t line)
+{
+  uint64_t hash = line_hash(line) & (HASH_RANGE - 1);
+  if (hash >= threshold)
+    return;
+
+  double weight = double(HASH_RANGE) / threshold;
+
+  if (now + 1 == tree.size())
+    compact();
+  now++;
+
+  auto it = lines.find(line);
+  if (it == lines.end()) {
+    interval_hist.cold += weight;
+    interval_hist.refs += weight;
+    total_hist.cold += weight;
+    total_hist.refs += weight;
+    interval_ws += weight;
+
+    lines[line] = {now, interval_index};
+    by_hash.insert({hash, line});
+    mark(now, 1);
+
+    if (lines.size() > max_lines)
+      shrink();
+    return;
+  }
+
+  line_t& l = it->second;
+  uint64_t distance = marked_up_to(now - 1) - marked_up_to(l.last);
+  interval_hist.add(distance * weight, weight);
+  total_hist.add(distance * weight, weight);
+  if (l.interval != interval_index)
+    interval_ws += weight;
+
+  mark(l.last, -1);
+  mark(now, 1);
+  l = {now, interval_index};
+}
+
+void reuse_profiler_t::shrink()
+{
+  // lower the sampling threshold until the tracked lines fit again
+  while (lines.size() > max_lines) {
+    threshold = by_hash.rbegin()->first;
+    while (!by_hash.empty() && by_hash.rbegin()->first >= threshold) {
+      auto victim = std::prev(by_hash.end());
+      auto it = lines.find(victim->second);
+      mark(it->second.last, -1);
+      lines.erase(it);
+      by_hash.erase(victim);
+    }
+  }
+}
+
+void reuse_profiler_t::compact()
+{
+  // renumber the live access times 1..n, preserving their order
+  std::vector<std::pair<uint64_t, line_t*>> live;
+  live.reserve(lines.size());
+  for (auto& l : lines)
+    live.push_back({l.second.last, &l.second});
+  std::sort(live.begin(), live.end(),
+            [](const std::pair<uint64_t, line_t*>& a, const std::pair<uint64_t, line_t*>& b) {
+              return a.first < b.first;
+            });
+
+  std::fill(tree.begin(), tree.end(), 0);
+  now = 0;
+  for (auto& l : live) {
+    l.second->last = ++now;
+    mark(now, 1);
+  }
+}
+
+void reuse_profiler_t::mark(uint64_t time, int delta)
+{
+  for (; time < tree.size(); time += time & -time)
+    tree[time] += delta;
+}
+
+uint64_t reuse_profiler_t::marked_up_to(uint64_t time)
+{
+  uint64_t sum = 0;
+  for (; time > 0; time -= time & -time)
+    sum += tree[time];
+  return sum;
+}
+
+void reuse_profiler_t::end_interval()
+{
+  std::cout << std::setprecision(0) << std::fixed;
+  std::cout << name << " Interval " << interval_index << ":"
+            << " insns " << interval_insns
+            << " refs " << interval_hist.refs
+            << " ws " << interval_ws
+            << " cold " << interval_hist.cold
+            << " hist";
+
+  size_t used = BUCKETS;
+  while (used > 0 && interval_hist.buckets[used - 1] < 0.5)
+    used--;
+  for (size_t i = 0; i < used; i++)
+    std::cout << ' ' << interval_hist.buckets[i];
+  std::cout << std::endl;
+
+  interval_hist = histogram_t();
+  interval_ws = 0;
+  interval_insns = 0;
+  interval_index++;
+}
+
+void reuse_profiler_t::print_stats()
+{
+  if (interval && interval_insns)
+    end_interval();
+
+  if (total_hist.refs == 0)
+    return;
+
+  std::cout << std::setprecision(3) << std::fixed;
+  std::cout << name << " ";
+  std::cout << "Instructions:          " << insns << std::endl;
+  std::cout << name << " ";
+  std::cout << "References:            " << std::llround(total_hist.refs) << std::endl;
+  std::cout << name << " ";
+  std::cout << "Cold References:       " << std::llround(total_hist.cold) << std::endl;
+  std::cout << name << " ";
+  std::cout << "Sampling Rate:         " << double(threshold) / HASH_RANGE << std::endl;
+
+  // a fully-associative LRU cache of 2^i lines hits exactly the references
+  // in buckets 0..i
+  double hits = 0;
+  for (size_t i = 0; i < BUCKETS; i++) {
+    if (total_hist.buckets[i] == 0)
+      continue;
+    hits += total_hist.buckets[i];
+    uint64_t lo = i ? uint64_t(1) << (i - 1) : 0;
+    uint64_t hi = uint64_t(1) << i;
+    std::cout << name << " ";
+    std::cout << "Distance [" << lo << ", " << hi << "): "
+              << std::llround(total_hist.buckets[i])
+              << " (LRU miss rate with " << hi << " lines: "
+              << 100 * (1 - hits / total_hist.refs) << "%)" << std::endl;
+  }
+}
@@ -0,0 +1,93 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_REUSE_PROFILER_H
+#define _RISCV_REUSE_PROFILER_H
+
+#include "memtracer.h"
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Measures reuse distances (the number of distinct cache lines touched
+// between two accesses to the same line) and working-set sizes over one
+// hart's loads, stores and fetches.
+//
+// Distances are computed exactly with a Fenwick tree over access times.
+// Lines are sampled SHARDS-style: a line is tracked only when a hash of its
+// address falls below a threshold, and distances and counts are scaled by
+// the resulting sampling rate.  At most max_lines lines are tracked; when
+// that is exceeded, the threshold is lowered and the lines above it are
+// dropped, so memory stays bounded and the profile stays exact for as long
+// as the footprint fits.
+//
+// A histogram is printed every interval instructions (counted as traced
+// fetches), and the whole-run histogram is printed by print_stats().
+class reuse_profiler_t : public memtracer_t
+{
+ public:
+  reuse_profiler_t(const char* name, uint64_t interval, double rate,
+                   size_t max_lines = DEFAULT_MAX_LINES);
+
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return true;
+  }
+  void trace(uint64_t addr, size_t bytes, access_type type);
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) {}
+  bool independent() { return true; }
+
+  void print_stats();
+
+  // parses "interval[:rate]" and exits with a usage message if malformed
+  static reuse_profiler_t* construct(const char* config, const char* name);
+
+ private:
+  static const size_t DEFAULT_MAX_LINES = 1 << 20;
+  static const unsigned LINE_SHIFT = 6;
+  static const uint64_t HASH_RANGE = uint64_t(1) << 24;
+  // bucket 0 is distance 0; bucket i > 0 holds [2^(i-1), 2^i)
+  static const size_t BUCKETS = 48;
+
+  struct line_t {
+    uint64_t last;     // time of the last access
+    uint64_t interval; // interval of the last access
+  };
+
+  struct histogram_t {
+    double refs = 0;
+    double cold = 0;
+    double buckets[BUCKETS] = {};
+    void add(uint64_t distance, double weight);
+  };
+
+  void access(uint64_t line);
+  void end_interval();
+  void shrink();
+  void compact();
+
+  // Fenwick tree over access times; a time is marked while it is the most
+  // recent access of some tracked line
+  void mark(uint64_t time, int delta);
+  uint64_t marked_up_to(uint64_t time);
+
+  std::string name;
+  uint64_t interval;
+  size_t max_lines;
+  uint64_t threshold;
+
+  std::unordered_map<uint64_t, line_t> lines;
+  std::set<std::pair<uint64_t, uint64_t>> by_hash; // (hash, line)
+  std::vector<int32_t> tree;
+  uint64_t now;
+
+  uint64_t insns;
+  uint64_t interval_index;
+  uint64_t interval_insns;
+  double interval_ws;
+  histogram_t interval_hist;
+  histogram_t total_hist;
+};
+
+#endif
@@ -60,6 +60,8 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
     histogram_enabled(false),
     log(false),
     remote_bitbang(NULL),
+    tohost_watched(false),
+    tohost_dirty(true),
     debug_module(this, dm_config)
 {
   signal(SIGINT, &handle_signal);
@@ -98,6 +100,31 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
     bus.add_device(clint_base, clint.get());
   }
 
+  // Likewise for the PLIC, which devices that raise interrupts hang off.
+  reg_t plic_base;
+  uint32_t plic_ndev;
+  if (fdt_parse_plic(fdt, &plic_base, &plic_ndev, "riscv,plic0") == 0) {
+    plic.reset(new plic_t(procs, std::min<uint32_t>(plic_ndev, PLIC_NDEV)));
+    bus.add_device(plic_base, plic.get());
+  }
+
+  if (cfg->virtio_blk_image) {
+    if (!plic) {
+      std::cerr << "--virtio-blk needs a PLIC (\"riscv,plic0\") in the device tree.\n";
+      exit(1);
+    }
+    virtio_blk.reset(new virtio_blk_t(this, plic.get(), VIRTIO_BLK_IRQ, *cfg->virtio_blk_image));
+    bus.add_device(VIRTIO_BLK_BASE, virtio_blk.get());
+  }
+
+  reg_t ns16550_base;
+  uint32_t ns16550_irq;
+  if (fdt_parse_ns16550(fdt, &ns16550_base, &ns16550_irq, "ns16550a") == 0) {
+    bool wired = plic && ns16550_irq > 0 && ns16550_irq <= std::min<uint32_t>(plic_ndev, PLIC_NDEV);
+    ns16550.reset(new ns16550_t(wired ? plic.get() : NULL, ns16550_irq));
+    bus.add_device(ns16550_base, ns16550.get());
+  }
+
   //per core attribute
   int cpu_offset = 0, rc;
   size_t cpu_idx = 0;
@@ -220,6 +247,7 @@ void sim_t::step(size_t n)
       if (++current_proc == procs.size()) {
         current_proc = 0;
         if (clint) clint->increment(INTERLEAVE / INSNS_PER_RTC_TICK);
+        if (ns16550) ns16550->tick();
       }
 
       host->switch_to();
@@ -240,7 +268,8 @@ void sim_t::set_histogram(bool value)
   }
 }
 
-void sim_t::configure_log(bool enable_log, bool enable_commitlog)
+void sim_t::configure_log(bool enable_log, bool enable_commitlog,
+                          bool binary_commitlog)
 {
   log = enable_log;
 
@@ -254,8 +283,17 @@ void sim_t::configure_log(bool enable_log, bool enable_commitlog)
         stderr);
   abort();
 #else
+  if (binary_commitlog) {
+    if (enable_log) {
+      fputs("The binary commit log cannot be combined with an instruction "
+            "trace (-l).\n", stderr);
+      abort();
+    }
+    commit_log_writer.reset(new commit_log_writer_t(log_file.get()));
+  }
+
   for (processor_t *proc : procs) {
-    proc->enable_log_commits();
+    proc->enable_log_commits(commit_log_writer.get());
   }
 #endif
 }
@@ -285,6 +323,14 @@ bool sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
   return bus.store(addr, len, bytes);
 }
 
+const char* sim_t::get_dts()
+{
+  // the source is only rendered for --dump-dts
+  if (dts.empty())
+    dts = dtb_to_dts(dtb);
+  return dts.c_str();
+}
+
 void sim_t::make_dtb()
 {
   if (!dtb_file.empty()) {
@@ -300,17 +346,17 @@ void sim_t::make_dtb()
     dtb = strstream.str();
   } else {
     std::pair<reg_t, reg_t> initrd_bounds = cfg->initrd_bounds();
-    dts = make_dts(INSNS_PER_RTC_TICK, CPU_HZ,
-                   initrd_bounds.first, initrd_bounds.second,
-                   cfg->bootargs(), procs, mems);
-    dtb = dts_compile(dts);
+    dtb = ::make_dtb(INSNS_PER_RTC_TICK, CPU_HZ,
+                     initrd_bounds.first, initrd_bounds.second,
+                     cfg->bootargs(), procs, mems,
+                     cfg->virtio_blk_image.has_value(), cfg->uart);
   }
 
   int fdt_code = fdt_check_header(dtb.c_str());
   if (fdt_code) {
     std::cerr << "Failed to read DTB from ";
     if (dtb_file.empty()) {
-      std::cerr << "auto-generated DTS string";
+      std::cerr << "auto-generated DTB";
     } else {
       std::cerr << "`" << dtb_file << "'";
     }
@@ -379,12 +425,44 @@ const char* sim_t::get_symbol(uint64_t addr)
   return htif_t::get_symbol(addr);
 }
 
+const char* sim_t::get_nearest_symbol(uint64_t addr)
+{
+  return htif_t::get_nearest_symbol(addr);
+}
+
 // htif
 
 void sim_t::reset()
 {
   if (dtb_enabled)
     set_rom();
+
+  // tohost can only be watched if it is in memory the harts access
+  // through their TLBs
+  addr_t tohost = get_tohost_addr();
+  tohost_watched = tohost && addr_to_mem(tohost);
+  tohost_dirty = true;
+  if (tohost_watched) {
+    for (auto p : procs)
+      p->get_mmu()->watch_store_page(tohost >> PGSHIFT);
+    debug_mmu->watch_store_page(tohost >> PGSHIFT);
+  }
+}
+
+void sim_t::store_watched(reg_t addr, size_t len)
+{
+  addr_t tohost = get_tohost_addr();
+  if (addr < tohost + sizeof(uint64_t) && tohost < addr + len)
+    tohost_dirty = true;
+}
+
+bool sim_t::tohost_written()
+{
+  if (!tohost_watched)
+    return true;
+  bool res = tohost_dirty;
+  tohost_dirty = false;
+  return res;
 }
 
 void sim_t::idle()
@@ -407,6 +485,50 @@ void sim_t::write_chunk(addr_t taddr, size_t len, const void* src)
   debug_mmu->store_uint64(taddr, debug_mmu->from_target(data));
 }
 
+char* sim_t::direct_host_addr(addr_t taddr, size_t len)
+{
+  // main memory is allocated a page at a time, so check that the range
+  // does not run past the page (or the memory) that taddr falls in
+  char* host = addr_to_mem(taddr);
+  if (!host || len == 0 || addr_to_mem(taddr + len - 1) != host + len - 1)
+    return NULL;
+  return host;
+}
+
+bool sim_t::map_file(addr_t taddr, size_t len, int fd, off_t offset)
+{
+  auto desc = bus.find_device(taddr);
+  if (auto mem = dynamic_cast<mem_t*>(desc.second))
+    return mem->map_file(taddr - desc.first, len, fd, offset);
+  return false;
+}
+
+bool sim_t::maps_file(dev_t dev, ino_t ino)
+{
+  for (auto& m : mems)
+    if (m.second->maps_file(dev, ino))
+      return true;
+  return false;
+}
+
+bool sim_t::detach_file(dev_t dev, ino_t ino)
+{
+  bool ok = true;
+  for (auto& m : mems)
+    ok &= m.second->detach_file(dev, ino);
+  return ok;
+}
+
+void sim_t::clear_chunk(addr_t taddr, size_t len)
+{
+  auto desc = bus.find_device(taddr);
+  auto mem = dynamic_cast<mem_t*>(desc.second);
+  if (mem && taddr - desc.first + len <= mem->size())
+    mem->clear(taddr - desc.first, len);
+  else
+    htif_t::clear_chunk(taddr, len);
+}
+
 void sim_t::set_target_endianness(memif_endianness_t endianness)
 {
 #ifdef RISCV_ENABLE_DUAL_ENDIAN
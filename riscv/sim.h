@@ -15,6 +15,7 @@
 #include "debug_module.h"
 #include "devices.h"
 #include "log_file.h"
+#include "commit_log_writer.h"
 #include "processor.h"
 #include "simif.h"
 
@@ -54,14 +55,17 @@ public:
   // If enable_log is true, an instruction trace will be generated. If
   // enable_commitlog is true, so will the commit results (if this
   // build was configured without support for commit logging, the
-  // function will print an error message and abort).
-  void configure_log(bool enable_log, bool enable_commitlog);
+  // function will print an error message and abort). If binary_commitlog
+  // is also true, the commit log is written in the compact binary format
+  // of commit_log_writer.h.
+  void configure_log(bool enable_log, bool enable_commitlog,
+                     bool binary_commitlog = false);
 
   void set_procs_debug(bool value);
   void set_remote_bitbang(remote_bitbang_t* remote_bitbang) {
     this->remote_bitbang = remote_bitbang;
   }
-  const char* get_dts() { if (dts.empty()) reset(); return dts.c_str(); }
+  const char* get_dts();
   processor_t* get_core(size_t i) { return procs.at(i); }
   unsigned nprocs() const { return procs.size(); }
 
@@ -82,8 +86,12 @@ private:
   bool dtb_enabled;
   std::unique_ptr<rom_device_t> boot_rom;
   std::unique_ptr<clint_t> clint;
+  std::unique_ptr<plic_t> plic;
+  std::unique_ptr<virtio_blk_t> virtio_blk;
+  std::unique_ptr<ns16550_t> ns16550;
   bus_t bus;
   log_file_t log_file;
+  std::unique_ptr<commit_log_writer_t> commit_log_writer;
 
   FILE *cmd_file; // pointer to debug command input file
 
@@ -117,6 +125,7 @@ private:
   void set_rom();
 
   const char* get_symbol(uint64_t addr);
+  const char* get_nearest_symbol(uint64_t addr);
 
   // presents a prompt for introspection into the simulation
   void interactive();
@@ -156,10 +165,21 @@ private:
   context_t target;
   void reset();
   void idle();
+  // harts report stores to tohost's page (see mmu_t::watch_store_page), so
+  // that htif_t::run only reads tohost after one of them has written it
+  bool tohost_watched;
+  bool tohost_dirty;
+  void store_watched(reg_t addr, size_t len);
+  bool tohost_written();
   void read_chunk(addr_t taddr, size_t len, void* dst);
   void write_chunk(addr_t taddr, size_t len, const void* src);
   size_t chunk_align() { return 8; }
   size_t chunk_max_size() { return 8; }
+  char* direct_host_addr(addr_t taddr, size_t len);
+  bool map_file(addr_t taddr, size_t len, int fd, off_t offset);
+  bool maps_file(dev_t dev, ino_t ino);
+  bool detach_file(dev_t dev, ino_t ino);
+  void clear_chunk(addr_t taddr, size_t len);
   void set_target_endianness(memif_endianness_t endianness);
   memif_endianness_t get_target_endianness() const;
 
@@ -18,6 +18,11 @@ public:
   virtual void proc_reset(unsigned id) = 0;
 
   virtual const char* get_symbol(uint64_t addr) = 0;
+  // the symbol at or below addr, or NULL if there is none
+  virtual const char* get_nearest_symbol(uint64_t addr) = 0;
+
+  // called for every store to the page passed to mmu_t::watch_store_page
+  virtual void store_watched(reg_t addr, size_t len) {}
 
 };
 
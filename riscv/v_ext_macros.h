@@ -1178,12 +1178,58 @@ reg_t index[P.VU.vlmax]; \
   } \
 }
 
+// unit-stride accesses go through host memory a page at a time when the MMU
+// allows it.  vstart records the progress made, so the element-wise loop that
+// follows resumes wherever the bulk access had to stop.
+#define VI_LD_BULK(elt_width, vd, n_elts) \
+  for (reg_t i = P.VU.vstart->read(); i < (n_elts); ) { \
+    const reg_t addr = baseAddr + i * sizeof(elt_width##_t); \
+    const reg_t n = std::min((n_elts) - i, (PGSIZE - addr % PGSIZE) / sizeof(elt_width##_t)); \
+    if (n == 0 || addr % sizeof(elt_width##_t) != 0) \
+      break; \
+    P.VU.vstart->write(i); \
+    const char* host_addr = MMU.bulk_host_addr(addr, n * sizeof(elt_width##_t), LOAD); \
+    if (!host_addr) \
+      break; \
+    for (reg_t k = 0; k < n; ++k) \
+      P.VU.elt<elt_width##_t>(vd, i + k, true) = \
+        MMU.from_target(unaligned_host_load<elt_width##_t>(host_addr + k * sizeof(elt_width##_t))); \
+    i += n; \
+    P.VU.vstart->write(i); \
+  }
+
+#define VI_ST_BULK(elt_width, vs3, n_elts) \
+  for (reg_t i = P.VU.vstart->read(); i < (n_elts); ) { \
+    const reg_t addr = baseAddr + i * sizeof(elt_width##_t); \
+    const reg_t n = std::min((n_elts) - i, (PGSIZE - addr % PGSIZE) / sizeof(elt_width##_t)); \
+    if (n == 0 || addr % sizeof(elt_width##_t) != 0) \
+      break; \
+    P.VU.vstart->write(i); \
+    char* host_addr = MMU.bulk_host_addr(addr, n * sizeof(elt_width##_t), STORE); \
+    if (!host_addr) \
+      break; \
+    for (reg_t k = 0; k < n; ++k) \
+      unaligned_host_store(host_addr + k * sizeof(elt_width##_t), \
+        MMU.to_target(P.VU.elt<elt_width##_t>(vs3, i + k))); \
+    i += n; \
+    P.VU.vstart->write(i); \
+  }
+
 #define VI_LD(stride, offset, elt_width, is_mask_ldst) \
+  VI_LD_COMMON(stride, offset, elt_width, is_mask_ldst, false)
+
+#define VI_LD_UNIT(elt_width, is_mask_ldst) \
+  VI_LD_COMMON(0, (i * nf + fn), elt_width, is_mask_ldst, true)
+
+#define VI_LD_COMMON(stride, offset, elt_width, is_mask_ldst, unit_stride) \
   const reg_t nf = insn.v_nf() + 1; \
   const reg_t vl = is_mask_ldst ? ((P.VU.vl->read() + 7) / 8) : P.VU.vl->read(); \
   const reg_t baseAddr = RS1; \
   const reg_t vd = insn.rd(); \
   VI_CHECK_LOAD(elt_width, is_mask_ldst); \
+  if (unit_stride && nf == 1 && insn.v_vm() == 1) { \
+    VI_LD_BULK(elt_width, vd, vl); \
+  } \
   for (reg_t i = 0; i < vl; ++i) { \
     VI_ELEMENT_SKIP(i); \
     VI_STRIP(i); \
@@ -1233,11 +1279,20 @@ reg_t index[P.VU.vlmax]; \
   P.VU.vstart->write(0);
 
 #define VI_ST(stride, offset, elt_width, is_mask_ldst) \
+  VI_ST_COMMON(stride, offset, elt_width, is_mask_ldst, false)
+
+#define VI_ST_UNIT(elt_width, is_mask_ldst) \
+  VI_ST_COMMON(0, (i * nf + fn), elt_width, is_mask_ldst, true)
+
+#define VI_ST_COMMON(stride, offset, elt_width, is_mask_ldst, unit_stride) \
   const reg_t nf = insn.v_nf() + 1; \
   const reg_t vl = is_mask_ldst ? ((P.VU.vl->read() + 7) / 8) : P.VU.vl->read(); \
   const reg_t baseAddr = RS1; \
   const reg_t vs3 = insn.rd(); \
   VI_CHECK_STORE(elt_width, is_mask_ldst); \
+  if (unit_stride && nf == 1 && insn.v_vm() == 1) { \
+    VI_ST_BULK(elt_width, vs3, vl); \
+  } \
   for (reg_t i = 0; i < vl; ++i) { \
     VI_STRIP(i) \
     VI_ELEMENT_SKIP(i); \
@@ -1329,6 +1384,7 @@ reg_t index[P.VU.vlmax]; \
   require_align(vd, len); \
   const reg_t elt_per_reg = P.VU.vlenb / sizeof(elt_width ## _t); \
   const reg_t size = len * elt_per_reg; \
+  VI_LD_BULK(elt_width, vd, size); \
   if (P.VU.vstart->read() < size) { \
     reg_t i = P.VU.vstart->read() / elt_per_reg; \
     reg_t off = P.VU.vstart->read() % elt_per_reg; \
@@ -1359,6 +1415,7 @@ reg_t index[P.VU.vlmax]; \
   const reg_t len = insn.v_nf() + 1; \
   require_align(vs3, len); \
   const reg_t size = len * P.VU.vlenb; \
+  VI_ST_BULK(uint8, vs3, size); \
   \
   if (P.VU.vstart->read() < size) { \
     reg_t i = P.VU.vstart->read() / P.VU.vlenb; \
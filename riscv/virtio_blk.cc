@@ -0,0 +1,390 @@
+#include "devices.h"
+#include "simif.h"
+#include "mmu.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/* virtio-mmio (version 2) block device registers:
+ * 000 magic value        004 version            008 device ID
+ * 00c vendor ID          010 device features    014 device features select
+ * 020 driver features    024 driver features select
+ * 030 queue select       034 queue size max     038 queue size
+ * 044 queue ready        050 queue notify
+ * 060 interrupt status   064 interrupt ack      070 device status
+ * 080 queue descriptor table (lo, hi)
+ * 090 queue available ring (lo, hi)
+ * 0a0 queue used ring (lo, hi)
+ * 0fc config generation
+ * 100 block device configuration: capacity in sectors (u64), size_max
+ *     (u32), seg_max (u32), ...
+ */
+
+#define VIRTIO_MMIO_MAGIC_VALUE		0x000
+#define VIRTIO_MMIO_VERSION		0x004
+#define VIRTIO_MMIO_DEVICE_ID		0x008
+#define VIRTIO_MMIO_VENDOR_ID		0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES	0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL	0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES	0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL	0x024
+#define VIRTIO_MMIO_QUEUE_SEL		0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX	0x034
+#define VIRTIO_MMIO_QUEUE_NUM		0x038
+#define VIRTIO_MMIO_QUEUE_READY		0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY	0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS	0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK	0x064
+#define VIRTIO_MMIO_STATUS		0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW	0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH	0x084
+#define VIRTIO_MMIO_QUEUE_AVAIL_LOW	0x090
+#define VIRTIO_MMIO_QUEUE_AVAIL_HIGH	0x094
+#define VIRTIO_MMIO_QUEUE_USED_LOW	0x0a0
+#define VIRTIO_MMIO_QUEUE_USED_HIGH	0x0a4
+#define VIRTIO_MMIO_CONFIG_GENERATION	0x0fc
+#define VIRTIO_MMIO_CONFIG		0x100
+
+#define VIRTIO_MAGIC			0x74726976
+#define VIRTIO_VENDOR			0x554d4551
+#define VIRTIO_ID_BLOCK			2
+
+#define VIRTIO_F_VERSION_1		(uint64_t(1) << 32)
+#define VIRTIO_BLK_F_SEG_MAX		(uint64_t(1) << 2)
+#define VIRTIO_BLK_F_RO			(uint64_t(1) << 5)
+#define VIRTIO_BLK_F_FLUSH		(uint64_t(1) << 9)
+
+#define VIRTIO_STATUS_FAILED		0x80
+
+#define VIRTQ_DESC_F_NEXT		1
+#define VIRTQ_DESC_F_WRITE		2
+#define VIRTQ_AVAIL_F_NO_INTERRUPT	1
+#define VIRTIO_INT_USED_RING		1
+
+#define VIRTIO_BLK_T_IN			0
+#define VIRTIO_BLK_T_OUT		1
+#define VIRTIO_BLK_T_FLUSH		4
+#define VIRTIO_BLK_T_GET_ID		8
+#define VIRTIO_BLK_S_OK			0
+#define VIRTIO_BLK_S_IOERR		1
+#define VIRTIO_BLK_S_UNSUPP		2
+
+#define VIRTIO_BLK_ID_BYTES		20
+#define SECTOR_SIZE			512
+#define QUEUE_NUM_MAX			256
+#define SEG_MAX				(QUEUE_NUM_MAX - 2)
+
+struct virtq_desc_t {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+};
+
+struct virtio_blk_req_header_t {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+};
+
+virtio_blk_t::virtio_blk_t(simif_t* sim, plic_t* plic, uint32_t interrupt_id, const std::string& image)
+  : sim(sim), plic(plic), interrupt_id(interrupt_id), read_only(false)
+{
+  fd = open(image.c_str(), O_RDWR);
+  if (fd < 0) {
+    fd = open(image.c_str(), O_RDONLY);
+    read_only = true;
+  }
+
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+    throw std::runtime_error("could not open disk image " + image);
+  capacity = st.st_size / SECTOR_SIZE;
+
+  reset();
+}
+
+virtio_blk_t::~virtio_blk_t()
+{
+  close(fd);
+}
+
+void virtio_blk_t::reset()
+{
+  device_features_sel = driver_features_sel = queue_sel = 0;
+  driver_features = 0;
+  status = 0;
+  interrupt_status = 0;
+  queue_num = 0;
+  queue_ready = false;
+  desc_addr = avail_addr = used_addr = 0;
+  last_avail_idx = 0;
+  plic->set_interrupt_level(interrupt_id, false);
+}
+
+uint64_t virtio_blk_t::device_features()
+{
+  return VIRTIO_F_VERSION_1 | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_FLUSH |
+         (read_only ? VIRTIO_BLK_F_RO : 0);
+}
+
+bool virtio_blk_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  if (addr >= VIRTIO_MMIO_CONFIG) {
+    uint32_t config[4] = {uint32_t(capacity), uint32_t(capacity >> 32), 0, SEG_MAX};
+    reg_t off = addr - VIRTIO_MMIO_CONFIG;
+    memset(bytes, 0, len);
+    if (off < sizeof(config))
+      memcpy(bytes, (char*)config + off, std::min<reg_t>(len, sizeof(config) - off));
+    return true;
+  }
+
+  if (len != sizeof(uint32_t) || addr % sizeof(uint32_t))
+    return false;
+
+  uint32_t val = 0;
+  switch (addr) {
+    case VIRTIO_MMIO_MAGIC_VALUE: val = VIRTIO_MAGIC; break;
+    case VIRTIO_MMIO_VERSION: val = 2; break;
+    case VIRTIO_MMIO_DEVICE_ID: val = VIRTIO_ID_BLOCK; break;
+    case VIRTIO_MMIO_VENDOR_ID: val = VIRTIO_VENDOR; break;
+    case VIRTIO_MMIO_DEVICE_FEATURES:
+      val = device_features_sel < 2 ? device_features() >> (32 * device_features_sel) : 0;
+      break;
+    case VIRTIO_MMIO_QUEUE_NUM_MAX: val = queue_sel == 0 ? QUEUE_NUM_MAX : 0; break;
+    case VIRTIO_MMIO_QUEUE_READY: val = queue_sel == 0 && queue_ready; break;
+    case VIRTIO_MMIO_INTERRUPT_STATUS: val = interrupt_status; break;
+    case VIRTIO_MMIO_STATUS: val = status; break;
+    case VIRTIO_MMIO_CONFIG_GENERATION: val = 0; break;
+  }
+
+  memcpy(bytes, &val, len);
+  return true;
+}
+
+bool virtio_blk_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+  if (addr >= VIRTIO_MMIO_CONFIG)
+    return true; // the configuration is read-only
+
+  if (len != sizeof(uint32_t) || addr % sizeof(uint32_t))
+    return false;
+
+  uint32_t val;
+  memcpy(&val, bytes, len);
+  switch (addr) {
+    case VIRTIO_MMIO_DEVICE_FEATURES_SEL: device_features_sel = val; break;
+    case VIRTIO_MMIO_DRIVER_FEATURES:
+      if (driver_features_sel < 2) {
+        driver_features &= ~(uint64_t(UINT32_MAX) << (32 * driver_features_sel));
+        driver_features |= uint64_t(val) << (32 * driver_features_sel);
+      }
+      break;
+    case VIRTIO_MMIO_DRIVER_FEATURES_SEL: driver_features_sel = val; break;
+    case VIRTIO_MMIO_QUEUE_SEL: queue_sel = val; break;
+    case VIRTIO_MMIO_QUEUE_NUM:
+      if (queue_sel == 0 && val <= QUEUE_NUM_MAX && (val & (val - 1)) == 0)
+        queue_num = val;
+      break;
+    case VIRTIO_MMIO_QUEUE_READY:
+      if (queue_sel == 0)
+        queue_ready = val & 1;
+      break;
+    case VIRTIO_MMIO_QUEUE_NOTIFY:
+      if (val == 0 && queue_ready && queue_num)
+        process_queue();
+      break;
+    case VIRTIO_MMIO_INTERRUPT_ACK:
+      interrupt_status &= ~val;
+      plic->set_interrupt_level(interrupt_id, interrupt_status != 0);
+      break;
+    case VIRTIO_MMIO_STATUS:
+      if (val == 0)
+        reset();
+      else
+        status = val;
+      break;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW: set_low(desc_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_DESC_HIGH: set_high(desc_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_AVAIL_LOW: set_low(avail_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_AVAIL_HIGH: set_high(avail_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_USED_LOW: set_low(used_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_USED_HIGH: set_high(used_addr, val); break;
+  }
+  return true;
+}
+
+// Copies between the device and main memory a page at a time, because
+// sim_t allocates memory a page at a time.
+bool virtio_blk_t::guest_copy(reg_t paddr, void* buf, size_t len, bool to_guest)
+{
+  while (len > 0) {
+    size_t n = std::min<size_t>(len, PGSIZE - paddr % PGSIZE);
+    char* host = sim->addr_to_mem(paddr);
+    if (!host)
+      return false;
+    if (to_guest)
+      memcpy(host, buf, n);
+    else
+      memcpy(buf, host, n);
+    paddr += n;
+    buf = (char*)buf + n;
+    len -= n;
+  }
+  return true;
+}
+
+// Appends the host memory holding the guest range, merging pages that are
+// contiguous on the host.
+bool virtio_blk_t::guest_iov(reg_t paddr, size_t len, std::vector<struct iovec>& iov)
+{
+  while (len > 0) {
+    size_t n = std::min<size_t>(len, PGSIZE - paddr % PGSIZE);
+    char* host = sim->addr_to_mem(paddr);
+    if (!host)
+      return false;
+    if (!iov.empty() && (char*)iov.back().iov_base + iov.back().iov_len == host)
+      iov.back().iov_len += n;
+    else
+      iov.push_back({host, n});
+    paddr += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Completes every request the driver has made available, then interrupts
+// the driver unless it asked not to be.
+void virtio_blk_t::process_queue()
+{
+  uint16_t avail_flags, avail_idx, used_idx;
+  if (!guest_copy(avail_addr, &avail_flags, sizeof(avail_flags), false) ||
+      !guest_copy(avail_addr + 2, &avail_idx, sizeof(avail_idx), false) ||
+      !guest_copy(used_addr + 2, &used_idx, sizeof(used_idx), false)) {
+    status |= VIRTIO_STATUS_FAILED;
+    return;
+  }
+
+  bool completed = false;
+  while (last_avail_idx != avail_idx) {
+    uint16_t head;
+    guest_copy(avail_addr + 4 + 2 * (last_avail_idx % queue_num), &head, sizeof(head), false);
+    last_avail_idx++;
+
+    uint32_t used[2] = {head, 0};
+    used[1] = handle_request(head);
+    guest_copy(used_addr + 4 + 8 * (used_idx % queue_num), used, sizeof(used), true);
+    used_idx++;
+    guest_copy(used_addr + 2, &used_idx, sizeof(used_idx), true);
+    completed = true;
+  }
+
+  if (completed && !(avail_flags & VIRTQ_AVAIL_F_NO_INTERRUPT)) {
+    interrupt_status |= VIRTIO_INT_USED_RING;
+    plic->set_interrupt_level(interrupt_id, true);
+  }
+}
+
+// Runs the request whose descriptor chain starts at head: a header the
+// device reads, the data buffers, and a status byte the device writes.
+// Returns the number of bytes written to the driver's buffers.
+uint32_t virtio_blk_t::handle_request(uint16_t head)
+{
+  std::vector<virtq_desc_t> chain;
+  for (uint16_t i = head; chain.size() < queue_num; ) {
+    virtq_desc_t desc;
+    if (i >= queue_num || !guest_copy(desc_addr + i * sizeof(desc), &desc, sizeof(desc), false))
+      return 0;
+    chain.push_back(desc);
+    if (!(desc.flags & VIRTQ_DESC_F_NEXT))
+      break;
+    i = desc.next;
+  }
+
+  virtio_blk_req_header_t hdr;
+  const virtq_desc_t& last = chain.back();
+  if (chain.size() < 2 || chain[0].len < sizeof(hdr) || chain[0].flags & VIRTQ_DESC_F_WRITE ||
+      !(last.flags & VIRTQ_DESC_F_WRITE) || last.len < 1 ||
+      !guest_copy(chain[0].addr, &hdr, sizeof(hdr), false))
+    return 0;
+
+  // the buffers between the header and the status byte
+  iov.clear();
+  size_t data_len = 0;
+  bool data_write = hdr.type == VIRTIO_BLK_T_IN || hdr.type == VIRTIO_BLK_T_GET_ID;
+  uint8_t res = VIRTIO_BLK_S_OK;
+  for (size_t i = 1; i < chain.size(); i++) {
+    reg_t len = chain[i].len - (i == chain.size() - 1);
+    if (!!(chain[i].flags & VIRTQ_DESC_F_WRITE) != data_write && len)
+      res = VIRTIO_BLK_S_IOERR;
+    else if (!guest_iov(chain[i].addr, len, iov))
+      res = VIRTIO_BLK_S_IOERR;
+    data_len += len;
+  }
+
+  uint32_t written = 0;
+  if (res == VIRTIO_BLK_S_OK) {
+    switch (hdr.type) {
+      case VIRTIO_BLK_T_IN:
+      case VIRTIO_BLK_T_OUT:
+        if (data_len % SECTOR_SIZE || hdr.sector > capacity ||
+            data_len / SECTOR_SIZE > capacity - hdr.sector ||
+            (hdr.type == VIRTIO_BLK_T_OUT && read_only) ||
+            !transfer(hdr.sector * SECTOR_SIZE, data_len, hdr.type == VIRTIO_BLK_T_OUT))
+          res = VIRTIO_BLK_S_IOERR;
+        else if (hdr.type == VIRTIO_BLK_T_IN)
+          written = data_len;
+        break;
+      case VIRTIO_BLK_T_FLUSH:
+        if (fdatasync(fd) != 0)
+          res = VIRTIO_BLK_S_IOERR;
+        break;
+      case VIRTIO_BLK_T_GET_ID: {
+        char id[VIRTIO_BLK_ID_BYTES] = "spike-virtio-blk";
+        size_t n = std::min<size_t>(data_len, sizeof(id));
+        for (size_t i = 0, done = 0; done < n; i++) {
+          size_t m = std::min(n - done, iov[i].iov_len);
+          memcpy(iov[i].iov_base, id + done, m);
+          done += m;
+        }
+        written = n;
+        break;
+      }
+      default:
+        res = VIRTIO_BLK_S_UNSUPP;
+    }
+  }
+
+  guest_copy(last.addr + last.len - 1, &res, sizeof(res), true);
+  return written + 1;
+}
+
+// Moves len bytes between the image at offset and the buffers in iov,
+// at most IOV_MAX of them per system call.
+bool virtio_blk_t::transfer(off_t offset, size_t len, bool write)
+{
+  size_t i = 0;
+  while (len > 0) {
+    int n = std::min<size_t>(IOV_MAX, iov.size() - i);
+    ssize_t res = write ? pwritev(fd, &iov[i], n, offset) : preadv(fd, &iov[i], n, offset);
+    if (res <= 0)
+      return false;
+
+    offset += res;
+    len -= res;
+    // drop the buffers that are done, and the done part of the next one
+    for (size_t done = res; done > 0; ) {
+      if (done >= iov[i].iov_len) {
+        done -= iov[i++].iov_len;
+      } else {
+        iov[i].iov_base = (char*)iov[i].iov_base + done;
+        iov[i].iov_len -= done;
+        done = 0;
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,256 @@
+// See LICENSE for license details.
+
+// This little program turns a binary commit log, as written by
+//   spike --log-commits --log-binary --log=FILE
+// back into the text format that --log-commits produces without
+// --log-binary.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "commit_log_writer.h"
+#include "disasm.h"
+
+static void fail(const char* msg)
+{
+  fprintf(stderr, "spike-commit-log: %s\n", msg);
+  exit(1);
+}
+
+class reader_t
+{
+ public:
+  reader_t(const uint8_t* p, const uint8_t* end) : p(p), end(end) {}
+
+  bool done() const { return p == end; }
+
+  uint8_t byte()
+  {
+    if (p == end)
+      fail("truncated record");
+    return *p++;
+  }
+
+  uint64_t get()
+  {
+    uint64_t x = 0;
+    for (int shift = 0; ; shift += 7) {
+      uint8_t b = byte();
+      x |= uint64_t(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        return x;
+    }
+  }
+
+  int64_t get_signed()
+  {
+    uint64_t x = get();
+    return int64_t(x >> 1) ^ -int64_t(x & 1);
+  }
+
+  const uint8_t* bytes(size_t n)
+  {
+    if (size_t(end - p) < n)
+      fail("truncated record");
+    const uint8_t* res = p;
+    p += n;
+    return res;
+  }
+
+ private:
+  const uint8_t* p;
+  const uint8_t* end;
+};
+
+static bool file_get(FILE* f, uint64_t* x)
+{
+  *x = 0;
+  for (int shift = 0; ; shift += 7) {
+    int c = getc(f);
+    if (c == EOF) {
+      if (shift)
+        fail("truncated chunk header");
+      return false;
+    }
+    *x |= uint64_t(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+}
+
+// must match commit_log_print_value in riscv/execute.cc
+static void print_value(FILE* out, int width, const void* data)
+{
+  switch (width) {
+    case 8:
+      fprintf(out, "0x%01" PRIx8, *(const uint8_t *)data);
+      break;
+    case 16:
+      fprintf(out, "0x%04" PRIx16, *(const uint16_t *)data);
+      break;
+    case 32:
+      fprintf(out, "0x%08" PRIx32, *(const uint32_t *)data);
+      break;
+    case 64:
+      fprintf(out, "0x%016" PRIx64, *(const uint64_t *)data);
+      break;
+    default:
+      if (((width - 1) & width) == 0) {
+        const uint64_t *arr = (const uint64_t *)data;
+
+        fprintf(out, "0x");
+        for (int idx = width / 64 - 1; idx >= 0; --idx) {
+          fprintf(out, "%016" PRIx64, arr[idx]);
+        }
+      } else {
+        abort();
+      }
+      break;
+  }
+}
+
+static void print_value(FILE* out, int width, uint64_t val)
+{
+  print_value(out, width, &val);
+}
+
+static void print_chunk(FILE* out, uint32_t hart_id, uint32_t vlen, reader_t& in)
+{
+  unsigned xlen = 0, flen = 0;
+  uint64_t next_pc = 0;
+  std::vector<uint64_t> vreg((vlen + 63) / 64);
+
+  while (!in.done()) {
+    uint8_t flags = in.byte();
+    if (flags & COMMIT_LOG_HAS_XLEN) {
+      xlen = in.get();
+      flen = in.get();
+    } else if (xlen == 0) {
+      fail("record without xlen at the start of a chunk");
+    }
+
+    uint64_t pc = next_pc + in.get_signed();
+    uint64_t length = in.get();
+    uint64_t bits = in.get();
+    next_pc = pc + length;
+
+    uint64_t vsew = 0, lmul = 0, vl = 0;
+    bool fractional = false;
+    if (flags & COMMIT_LOG_HAS_VCONFIG) {
+      vsew = in.get();
+      fractional = in.byte();
+      lmul = in.get();
+      vl = in.get();
+    }
+
+    fprintf(out, "core%4" PRId32 ": ", hart_id);
+    fprintf(out, "%1d ", flags & COMMIT_LOG_PRIV_MASK);
+    print_value(out, xlen, pc);
+    fprintf(out, " (");
+    print_value(out, length * 8, bits);
+    fprintf(out, ")");
+    bool show_vec = false;
+
+    for (uint64_t n = in.get(); n > 0; n--) {
+      uint64_t key = in.get();
+      int rd = key >> 4;
+      uint64_t value[2] = {0, 0};
+      const void* data = value;
+      int size = xlen;
+      char prefix = 'x';
+      bool is_vec = false;
+      bool is_vreg = false;
+      switch (key & 0xf) {
+      case 0:
+        value[0] = in.get();
+        break;
+      case 1:
+        size = flen;
+        prefix = 'f';
+        value[0] = in.get();
+        value[1] = in.get();
+        break;
+      case 2:
+        size = vlen;
+        prefix = 'v';
+        is_vreg = true;
+        memcpy(vreg.data(), in.bytes(vlen / 8), vlen / 8);
+        data = vreg.data();
+        break;
+      case 3:
+        is_vec = true;
+        break;
+      case 4:
+        prefix = 'c';
+        value[0] = in.get();
+        break;
+      default:
+        fail("bad register key");
+      }
+
+      if (!show_vec && (is_vreg || is_vec)) {
+        fprintf(out, " e%ld %s%ld l%ld",
+                (long)vsew, fractional ? "mf" : "m", (long)lmul, (long)vl);
+        show_vec = true;
+      }
+
+      if (!is_vec) {
+        if (prefix == 'c')
+          fprintf(out, " c%d_%s ", rd, csr_name(rd));
+        else
+          fprintf(out, " %c%-2d ", prefix, rd);
+        print_value(out, size, data);
+      }
+    }
+
+    for (uint64_t n = in.get(); n > 0; n--) {
+      fprintf(out, " mem ");
+      print_value(out, xlen, in.get());
+    }
+
+    for (uint64_t n = in.get(); n > 0; n--) {
+      uint64_t addr = in.get();
+      uint64_t value = in.get();
+      uint8_t size = in.byte();
+      fprintf(out, " mem ");
+      print_value(out, xlen, addr);
+      fprintf(out, " ");
+      print_value(out, size << 3, value);
+    }
+    fprintf(out, "\n");
+  }
+}
+
+int main(int argc, char** argv)
+{
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [binary commit log]\n", argv[0]);
+    return 1;
+  }
+
+  FILE* in = argc == 2 ? fopen(argv[1], "rb") : stdin;
+  if (!in)
+    fail("could not open input");
+
+  char magic[sizeof(COMMIT_LOG_MAGIC) - 1];
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, COMMIT_LOG_MAGIC, sizeof(magic)) != 0)
+    fail("not a binary commit log");
+
+  std::vector<uint8_t> payload;
+  uint64_t hart_id, vlen, size;
+  while (file_get(in, &hart_id)) {
+    if (!file_get(in, &vlen) || !file_get(in, &size))
+      fail("truncated chunk header");
+    payload.resize(size);
+    if (fread(payload.data(), 1, size, in) != size)
+      fail("truncated chunk");
+    reader_t reader(payload.data(), payload.data() + size);
+    print_chunk(stdout, hart_id, vlen, reader);
+  }
+
+  return 0;
+}
@@ -0,0 +1,43 @@
+// See LICENSE for license details.
+
+// This little program decompresses a log written by spike to a path ending
+// in ".z", e.g.
+//   spike --log-commits --log=trace.txt.z ...
+//   spike-log-cat trace.txt.z | less
+
+#include <cstdio>
+#include <vector>
+
+#include "compress.h"
+
+int main(int argc, char** argv)
+{
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [compressed log]\n", argv[0]);
+    return 1;
+  }
+
+  FILE* in = argc == 2 ? fopen(argv[1], "rb") : stdin;
+  if (!in) {
+    fprintf(stderr, "spike-log-cat: could not open %s\n", argv[1]);
+    return 1;
+  }
+
+  block_decompressor_t decompressor(in);
+  if (!decompressor.open()) {
+    fprintf(stderr, "spike-log-cat: not a compressed log\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> block;
+  while (decompressor.next(block)) {
+    if (fwrite(block.data(), 1, block.size(), stdout) != block.size())
+      return 1;
+  }
+
+  if (decompressor.error()) {
+    fprintf(stderr, "spike-log-cat: truncated or corrupt block\n");
+    return 1;
+  }
+  return 0;
+}
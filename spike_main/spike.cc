@@ -5,6 +5,8 @@
 #include "mmu.h"
 #include "remote_bitbang.h"
 #include "cachesim.h"
+#include "async_memtracer.h"
+#include "reuse_profiler.h"
 #include "extension.h"
 #include <dlfcn.h>
 #include <fesvr/option_parser.h>
@@ -14,6 +16,7 @@
 #include <string>
 #include <memory>
 #include <fstream>
+#include <algorithm>
 #include "../VERSION"
 
 static void help(int exit_code = 1)
@@ -33,7 +36,12 @@ static void help(int exit_code = 1)
 #endif
   fprintf(stderr, "  -h, --help            Print this help message\n");
   fprintf(stderr, "  -H                    Start halted, allowing a debugger to connect\n");
-  fprintf(stderr, "  --log=<name>          File name for option -l\n");
+  fprintf(stderr, "  --log=<name>          File name for option -l; a name ending in .z is\n");
+  fprintf(stderr, "                          compressed on a worker thread (read it back with\n");
+  fprintf(stderr, "                          spike-log-cat)\n");
+  fprintf(stderr, "  --log-binary          Write the --log-commits log in a compact binary format,\n");
+  fprintf(stderr, "                          which spike-commit-log converts back to text\n");
+  fprintf(stderr, "                          (requires --log, and cannot be combined with -l)\n");
   fprintf(stderr, "  --debug-cmd=<name>    Read commands from file (use with -d)\n");
   fprintf(stderr, "  --isa=<name>          RISC-V ISA string [default %s]\n", DEFAULT_ISA);
   fprintf(stderr, "  --priv=<m|mu|msu>     RISC-V privilege modes supported [default %s]\n", DEFAULT_PRIV);
@@ -42,7 +50,11 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --hartids=<a,b,...>   Explicitly specify hartids, default is 0,1,...\n");
   fprintf(stderr, "  --ic=<S>:<W>:<B>      Instantiate a cache model with S sets,\n");
   fprintf(stderr, "  --dc=<S>:<W>:<B>        W ways, and B-byte blocks (with S and\n");
-  fprintf(stderr, "  --l2=<S>:<W>:<B>        B both powers of 2).\n");
+  fprintf(stderr, "  --l2=<S>:<W>:<B>        B both powers of 2).  Append :<P> to pick the\n");
+  fprintf(stderr, "                          replacement policy (random, lru, plru, srrip,\n");
+  fprintf(stderr, "                          brrip).  A comma-separated list of\n");
+  fprintf(stderr, "                          configurations sweeps every combination in one\n");
+  fprintf(stderr, "                          run and prints a table of miss rates.\n");
   fprintf(stderr, "  --device=<P,B,A>      Attach MMIO plugin device from an --extlib library\n");
   fprintf(stderr, "                          P -- Name of the MMIO plugin\n");
   fprintf(stderr, "                          B -- Base memory address of the device\n");
@@ -50,6 +62,12 @@ static void help(int exit_code = 1)
   fprintf(stderr, "                          This flag can be used multiple times.\n");
   fprintf(stderr, "                          The extlib flag for the library must come first.\n");
   fprintf(stderr, "  --log-cache-miss      Generate a log of cache miss\n");
+  fprintf(stderr, "  --cache-thread        Run the cache models on a separate thread\n");
+  fprintf(stderr, "  --reuse-profile=<I>[:<R>]\n");
+  fprintf(stderr, "                        Profile cache-line reuse distances and working\n");
+  fprintf(stderr, "                          sets, printing a histogram every I instructions\n");
+  fprintf(stderr, "                          and sampling a fraction R of the lines\n");
+  fprintf(stderr, "  --mmu-stats           Print page-walk statistics for each hart at exit\n");
   fprintf(stderr, "  --extension=<name>    Specify RoCC Extension\n");
   fprintf(stderr, "                          This flag can be used multiple times.\n");
   fprintf(stderr, "  --extlib=<name>       Shared library to load\n");
@@ -62,6 +80,10 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --initrd=<path>       Load kernel initrd into memory\n");
   fprintf(stderr, "  --bootargs=<args>     Provide custom bootargs for kernel [default: console=hvc0 earlycon=sbi]\n");
   fprintf(stderr, "  --real-time-clint     Increment clint time at real-time rate\n");
+  fprintf(stderr, "  --virtio-blk=<path>   Attach a virtio block device backed by the raw disk\n");
+  fprintf(stderr, "                          image <path> (read-only if it is not writable)\n");
+  fprintf(stderr, "  --uart                Attach an ns16550a UART on the terminal and make it the\n");
+  fprintf(stderr, "                          console [default bootargs: console=ttyS0 earlycon]\n");
   fprintf(stderr, "  --dm-progsize=<words> Progsize for the debug module [default 2]\n");
   fprintf(stderr, "  --dm-sba=<bits>       Debug system bus access supports up to "
       "<bits> wide accesses [default 0]\n");
@@ -248,11 +270,18 @@ int main(int argc, char** argv)
   const char* kernel = NULL;
   reg_t kernel_offset, kernel_size;
   std::vector<std::pair<reg_t, abstract_device_t*>> plugin_devices;
-  std::unique_ptr<icache_sim_t> ic;
-  std::unique_ptr<dcache_sim_t> dc;
-  std::unique_ptr<cache_sim_t> l2;
+  const char* ic = NULL;
+  const char* dc = NULL;
+  const char* l2 = NULL;
+  std::unique_ptr<cache_sweep_t> caches;
+  std::vector<std::unique_ptr<memtracer_worker_t>> cache_workers;
+  bool cache_thread = false;
+  const char* reuse_profile = NULL;
+  std::vector<std::unique_ptr<reuse_profiler_t>> reuse_profilers;
   bool log_cache = false;
+  bool mmu_stats = false;
   bool log_commits = false;
+  bool log_binary = false;
   const char *log_path = nullptr;
   std::vector<std::function<extension_t*()>> extensions;
   const char* initrd = NULL;
@@ -344,10 +373,13 @@ int main(int argc, char** argv)
     cfg.hartids = parse_hartids(s);
     cfg.explicit_hartids = true;
   });
-  parser.option(0, "ic", 1, [&](const char* s){ic.reset(new icache_sim_t(s));});
-  parser.option(0, "dc", 1, [&](const char* s){dc.reset(new dcache_sim_t(s));});
-  parser.option(0, "l2", 1, [&](const char* s){l2.reset(cache_sim_t::construct(s, "L2$"));});
+  parser.option(0, "ic", 1, [&](const char* s){ic = s;});
+  parser.option(0, "dc", 1, [&](const char* s){dc = s;});
+  parser.option(0, "l2", 1, [&](const char* s){l2 = s;});
   parser.option(0, "log-cache-miss", 0, [&](const char* s){log_cache = true;});
+  parser.option(0, "cache-thread", 0, [&](const char* s){cache_thread = true;});
+  parser.option(0, "reuse-profile", 1, [&](const char* s){reuse_profile = s;});
+  parser.option(0, "mmu-stats", 0, [&](const char* s){mmu_stats = true;});
   parser.option(0, "isa", 1, [&](const char* s){cfg.isa = s;});
   parser.option(0, "priv", 1, [&](const char* s){cfg.priv = s;});
   parser.option(0, "varch", 1, [&](const char* s){cfg.varch = s;});
@@ -360,6 +392,8 @@ int main(int argc, char** argv)
   parser.option(0, "initrd", 1, [&](const char* s){initrd = s;});
   parser.option(0, "bootargs", 1, [&](const char* s){cfg.bootargs = s;});
   parser.option(0, "real-time-clint", 0, [&](const char *s){cfg.real_time_clint = true;});
+  parser.option(0, "virtio-blk", 1, [&](const char *s){cfg.virtio_blk_image = s;});
+  parser.option(0, "uart", 0, [&](const char *s){cfg.uart = true;});
   parser.option(0, "extlib", 1, [&](const char *s){
     void *lib = dlopen(s, RTLD_NOW | RTLD_GLOBAL);
     if (lib == NULL) {
@@ -387,6 +421,8 @@ int main(int argc, char** argv)
       [&](const char* s){dm_config.support_haltgroups = false;});
   parser.option(0, "log-commits", 0,
                 [&](const char* s){log_commits = true;});
+  parser.option(0, "log-binary", 0,
+                [&](const char* s){log_binary = true;});
   parser.option(0, "log", 1,
                 [&](const char* s){log_path = s;});
   FILE *cmd_file = NULL;
@@ -410,6 +446,13 @@ int main(int argc, char** argv)
   if (!*argv1)
     help();
 
+  // the binary commit log must not end up interleaved on stderr
+  if (log_binary && (!log_path || log)) {
+    fprintf(stderr, log ? "--log-binary cannot be combined with -l\n"
+                        : "--log-binary requires --log=<name>\n");
+    suggest_help();
+  }
+
   std::vector<std::pair<reg_t, mem_t*>> mems = make_mems(cfg.mem_layout());
 
   if (kernel && check_file_exists(kernel)) {
@@ -502,25 +545,64 @@ int main(int argc, char** argv)
     return 0;
   }
 
-  if (ic && l2) ic->set_miss_handler(&*l2);
-  if (dc && l2) dc->set_miss_handler(&*l2);
-  if (ic) ic->set_log(log_cache);
-  if (dc) dc->set_log(log_cache);
+  if (ic || dc)
+    caches.reset(new cache_sweep_t(ic, dc, l2, cfg.nprocs(), log_cache));
+
+  // with --cache-thread, the hierarchies are sharded round-robin across
+  // worker threads, one per host CPU at most
+  std::vector<cache_sweep_t::point_t> no_points;
+  auto& points = caches ? caches->get_points() : no_points;
+  if (cache_thread && !points.empty()) {
+    size_t nworkers = std::min<size_t>(points.size(), std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t i = 0; i < nworkers; i++)
+      cache_workers.emplace_back(new memtracer_worker_t());
+  }
+
   for (size_t i = 0; i < cfg.nprocs(); i++)
   {
-    if (ic) s.get_core(i)->get_mmu()->register_memtracer(&*ic);
-    if (dc) s.get_core(i)->get_mmu()->register_memtracer(&*dc);
+    for (size_t w = 0; w < cache_workers.size(); w++) {
+      async_memtracer_t* t = cache_workers[w]->new_tracer();
+      for (size_t p = w; p < points.size(); p += cache_workers.size()) {
+        if (!points[p].ic.empty()) t->hook(&*points[p].ic[i]);
+        if (!points[p].dc.empty()) t->hook(&*points[p].dc[i]);
+      }
+      s.get_core(i)->get_mmu()->register_memtracer(t);
+    }
+    if (cache_workers.empty()) {
+      for (auto& p : points) {
+        if (!p.ic.empty()) s.get_core(i)->get_mmu()->register_memtracer(&*p.ic[i]);
+        if (!p.dc.empty()) s.get_core(i)->get_mmu()->register_memtracer(&*p.dc[i]);
+      }
+    }
+    if (reuse_profile) {
+      std::string name = cfg.nprocs() > 1 ? "Reuse" + std::to_string(i) : "Reuse";
+      reuse_profilers.emplace_back(reuse_profiler_t::construct(reuse_profile, name.c_str()));
+      s.get_core(i)->get_mmu()->register_memtracer(&*reuse_profilers.back());
+    }
     for (auto e : extensions)
       s.get_core(i)->register_extension(e());
     s.get_core(i)->get_mmu()->set_cache_blocksz(blocksz);
   }
 
   s.set_debug(debug);
-  s.configure_log(log, log_commits);
+  s.configure_log(log, log_commits, log_binary);
   s.set_histogram(histogram);
 
+  for (auto& w : cache_workers)
+    w->start();
+
   auto return_code = s.run();
 
+  // let the cache models catch up before their statistics are printed
+  cache_workers.clear();
+
+  for (auto& r : reuse_profilers)
+    r->print_stats();
+
+  if (mmu_stats)
+    for (size_t i = 0; i < cfg.nprocs(); i++)
+      s.get_core(i)->get_mmu()->print_stats();
+
   for (auto& mem : mems)
     delete mem.second;
 